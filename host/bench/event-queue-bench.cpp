@@ -0,0 +1,177 @@
+// -*- c++ -*-
+
+// Microbenchmark comparing the linear and circular `EventQueue` layouts, each with full
+// and compact (one-byte delta) timestamps, and with captured keys (`capture_keys`, whose
+// extra RAM shows in the "bytes" column), at several queue sizes. Each pattern reports
+// nanoseconds per queued event:
+//
+//   drain   fill the queue, then shift every event off it (a resolved burst)
+//   steady  hold the queue one short of full, appending and shifting one event at a time
+//   remove  fill the queue, then remove events from the middle until it's empty
+//   walk    read every event's addr, timestamp and release bit (an `updateFlushEvent()`
+//           pass over a full queue)
+//   search  for each release in a full queue (half presses, then the matching half
+//           releases), search the earlier entries for its press
+//   paired  answer the same question with `isPaired()`, which costs `total_keys` bits
+//           plus one bit per entry of RAM (included in the "bytes" column), and moves
+//           the search to the points where a pair is formed or broken (included in the
+//           drain, steady and remove columns)
+//
+// Usage: event-queue-bench [rounds]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+
+#include <kaleidoglyph/Controller.h>
+#include <kaleidoglyph/KeyEvent.h>
+
+#include "qukeys/EventQueue.h"
+
+using namespace kaleidoglyph;
+
+namespace {
+
+volatile uint32_t sink;
+
+KeyEvent makeEvent(uint32_t n) {
+  KeyEvent event;
+  event.addr  = KeyAddr(n % total_keys);
+  event.state = (n & 1) ? cKeyState::release : cKeyState::press;
+  return event;
+}
+
+template <typename _Function>
+double timeIt(uint32_t rounds, uint32_t events_per_round, _Function function) {
+  double best{0};
+  for (int r{0}; r < 5; ++r) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i{0}; i < rounds; ++i) {
+      function(i);
+    }
+    auto stop = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+    if (r == 0 || ns < best) best = ns;
+  }
+  return best / (double(rounds) * events_per_round);
+}
+
+template <typename _Queue, byte _max_length>
+void benchQueue(const char* layout, uint32_t rounds) {
+  _Queue queue;
+
+  double drain = timeIt(rounds, _max_length, [&](uint32_t i) {
+      Controller::setScanStartTime(i);
+      for (byte n{0}; n < _max_length; ++n) {
+        queue.append(makeEvent(i + n));
+      }
+      uint32_t acc{0};
+      while (!queue.isEmpty()) {
+        acc += queue.head().addr.addr();
+        queue.shift();
+      }
+      sink = acc;
+    });
+
+  queue.clear();
+  for (byte n{0}; n < _max_length - 1; ++n) {
+    queue.append(makeEvent(n));
+  }
+  double steady = timeIt(rounds * _max_length, 1, [&](uint32_t i) {
+      Controller::setScanStartTime(i);
+      queue.append(makeEvent(i));
+      sink = queue.head().addr.addr();
+      queue.shift();
+    });
+
+  queue.clear();
+  double remove = timeIt(rounds, _max_length, [&](uint32_t i) {
+      for (byte n{0}; n < _max_length; ++n) {
+        queue.append(makeEvent(i + n));
+      }
+      while (!queue.isEmpty()) {
+        queue.remove(queue.length() / 2);
+      }
+    });
+
+  for (byte n{0}; n < _max_length; ++n) {
+    queue.append(makeEvent(n));
+  }
+  double walk = timeIt(rounds, _max_length, [&](uint32_t) {
+      uint32_t acc{0};
+      for (byte n{0}; n < queue.length(); ++n) {
+        acc += queue.addr(n).addr() + queue.timestamp(n) + queue.isRelease(n);
+      }
+      sink = acc;
+    });
+
+  queue.clear();
+  for (byte n{0}; n < _max_length; ++n) {
+    KeyEvent event;
+    event.addr  = KeyAddr(n % (_max_length / 2));
+    event.state = (n < _max_length / 2) ? cKeyState::press : cKeyState::release;
+    queue.append(event);
+  }
+  double search = timeIt(rounds, _max_length, [&](uint32_t) {
+      uint32_t acc{0};
+      for (byte i{1}; i < queue.length(); ++i) {
+        if (queue.isRelease(i)) {
+          for (byte j{1}; j < i; ++j) {
+            if (queue.isPress(j) && queue.addr(j) == queue.addr(i)) {
+              ++acc;
+              break;
+            }
+          }
+        }
+      }
+      sink = acc;
+    });
+  double paired = timeIt(rounds, _max_length, [&](uint32_t) {
+      uint32_t acc{0};
+      for (byte i{1}; i < queue.length(); ++i) {
+        if (queue.isRelease(i) && queue.isPaired(i)) {
+          ++acc;
+        }
+      }
+      sink = acc;
+    });
+
+  printf("%4u %-17s %6zu %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f\n", unsigned(_max_length),
+         layout, sizeof(_Queue), drain, steady, remove, walk, search, paired);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  uint32_t rounds = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 200000;
+
+  printf("EventQueue layouts, ns per event (best of 5 runs of %u rounds)\n", rounds);
+  printf("%4s %-17s %6s %8s %8s %8s %8s %8s %8s\n",
+         "max", "layout", "bytes", "drain", "steady", "remove", "walk", "search", "paired");
+  benchQueue<EventQueue<8, uint8_t, uint16_t, false>, 8>("linear", rounds);
+  benchQueue<EventQueue<8, uint8_t, uint16_t, false, true>, 8>("linear/compact", rounds);
+  benchQueue<EventQueue<8, uint8_t, uint16_t, true>, 8>("circular", rounds);
+  benchQueue<EventQueue<8, uint8_t, uint16_t, true, true>, 8>("circular/compact", rounds);
+  benchQueue<EventQueue<8, uint8_t, uint16_t, false, false, true>, 8>("linear/keys", rounds);
+  benchQueue<EventQueue<8, uint8_t, uint16_t, true, false, true>, 8>("circular/keys", rounds);
+  benchQueue<EventQueue<16, uint16_t, uint16_t, false>, 16>("linear", rounds);
+  benchQueue<EventQueue<16, uint16_t, uint16_t, false, true>, 16>("linear/compact", rounds);
+  benchQueue<EventQueue<16, uint16_t, uint16_t, true>, 16>("circular", rounds);
+  benchQueue<EventQueue<16, uint16_t, uint16_t, true, true>, 16>("circular/compact", rounds);
+  benchQueue<EventQueue<16, uint16_t, uint16_t, false, false, true>, 16>("linear/keys", rounds);
+  benchQueue<EventQueue<16, uint16_t, uint16_t, true, false, true>, 16>("circular/keys", rounds);
+  benchQueue<EventQueue<32, uint32_t, uint16_t, false>, 32>("linear", rounds);
+  benchQueue<EventQueue<32, uint32_t, uint16_t, false, true>, 32>("linear/compact", rounds);
+  benchQueue<EventQueue<32, uint32_t, uint16_t, true>, 32>("circular", rounds);
+  benchQueue<EventQueue<32, uint32_t, uint16_t, true, true>, 32>("circular/compact", rounds);
+  benchQueue<EventQueue<32, uint32_t, uint16_t, false, false, true>, 32>("linear/keys", rounds);
+  benchQueue<EventQueue<32, uint32_t, uint16_t, true, false, true>, 32>("circular/keys", rounds);
+  benchQueue<EventQueue<64, uint64_t, uint16_t, false, false, false>, 64>("linear", rounds);
+  benchQueue<EventQueue<64, uint64_t, uint16_t, false, true, false>, 64>("linear/compact", rounds);
+  benchQueue<EventQueue<64, uint64_t, uint16_t, true, false, false>, 64>("circular", rounds);
+  benchQueue<EventQueue<64, uint64_t, uint16_t, true, true, false>, 64>("circular/compact", rounds);
+  benchQueue<EventQueue<64, uint64_t, uint16_t, false, false, true>, 64>("linear/keys", rounds);
+  benchQueue<EventQueue<64, uint64_t, uint16_t, true, false, true>, 64>("circular/keys", rounds);
+  return 0;
+}
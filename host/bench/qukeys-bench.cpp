@@ -0,0 +1,140 @@
+// -*- c++ -*-
+
+// Host microbenchmark for the Qukeys engine. Each scenario is a generated keyswitch
+// event sequence that gets fed through `qukeys::Plugin` one scan cycle (1ms) at a time,
+// and the wall-clock time of the whole run is reported per scan cycle and per input
+// event. The output count and checksum identify the resolved event stream, so a change
+// that is meant to be a pure optimisation should leave both columns unchanged. If the
+// engine is built with `collect_stats`, each scenario's row is followed by its queue
+// statistics; if it's built with `adaptive_hold_timeout`, by the adaptive timeout's
+// final estimate; if it's built with `batch_flush`, by the number of batches the output
+// was delivered in.
+//
+// Usage: qukeys-bench [keystrokes [repeats]]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include <kaleidoglyph/Controller.h>
+#include <kaleidoglyph/Keymap.h>
+
+#include "Harness.h"
+#include "qukeys/Qukeys.h"
+
+using namespace kaleidoglyph;
+
+namespace {
+
+const char* const resolution_names[] = {
+  "hold-timeout", "own-release", "next-press", "next-release",
+  "overlap-timeout", "full-queue", "inactive", "same-zone",
+};
+
+void printStats(const qukeys::Stats<qukeys::collect_stats>& stats) {
+  printf("  resolutions:");
+  for (byte r{0}; r < byte(qukeys::Resolution::count); ++r) {
+    printf(" %s=%u", resolution_names[r], stats.resolutionCount(qukeys::Resolution(r)));
+  }
+  if (qukeys::flush_budget != 0) {
+    printf("\n  flush budget (%u) hit: %u", unsigned(qukeys::flush_budget),
+           stats.budgetHitCount());
+  }
+  printf("\n  dwell (ms):");
+  for (byte b{0}; b != stats.dwell_buckets; ++b) {
+    if (b + 1 == stats.dwell_buckets) {
+      printf(" >=%u:%u", (1u << b) >> 1, stats.dwellCount(b));
+    } else {
+      printf(" <%u:%u", 1u << b, stats.dwellCount(b));
+    }
+  }
+  printf("\n");
+}
+
+struct Result {
+  uint32_t events;
+  uint32_t scans;
+  uint32_t outputs;
+  uint32_t batches;
+  uint32_t checksum;
+  double   best_ns;
+  qukeys::Stats<qukeys::collect_stats> stats;
+  qukeys::HoldTimeout hold_timeout;
+};
+
+Result runScenario(host::Scenario scenario, uint32_t keystrokes, int repeats) {
+  Keymap keymap;
+  host::setupKeymap(keymap);
+  Controller controller;
+
+  host::EventSequence events = host::generate(scenario, keystrokes, 0x5EED);
+
+  Result result{uint32_t(events.size()), 0, 0, 0, 0, 0, {}, {}};
+  for (int r{0}; r < repeats; ++r) {
+    controller.reset();
+    qukeys::Plugin plugin(host::test_qukeys, keymap, controller);
+    host::useMultiTaps(plugin);
+
+    auto start = std::chrono::steady_clock::now();
+    result.scans = host::runSequence(plugin, controller, events);
+    auto stop = std::chrono::steady_clock::now();
+
+    double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+    if (r == 0 || ns < result.best_ns) {
+      result.best_ns = ns;
+    }
+    result.outputs  = controller.eventCount();
+    result.batches  = controller.batchCount();
+    result.checksum = controller.checksum();
+    result.stats    = plugin.stats();
+    result.hold_timeout = plugin.adaptiveHoldTimeout();
+  }
+  return result;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  uint32_t keystrokes = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 20000;
+  int      repeats    = (argc > 2) ? atoi(argv[2]) : 5;
+
+  printf("queue_max=%u multi-tap=%u sources=%u ticks/ms=%u circular=%d bypass=%d "
+         "release-flush=%d capture-keys=%d bilateral=%d concurrent=%d sizeof(Plugin)=%zu\n",
+         unsigned(qukeys::queue_max), unsigned(qukeys::multi_tap_max), unsigned(qukeys::source_count),
+         unsigned(qukeys::timestamp_ticks_per_ms),
+         int(qukeys::circular_event_queue),
+         int(qukeys::bypass_empty_queue), int(qukeys::flush_unrelated_releases),
+         int(qukeys::capture_keys), int(qukeys::bilateral_resolution),
+         int(qukeys::concurrent_resolution), sizeof(qukeys::Plugin));
+  printf("keystrokes=%u repeats=%d (best run)\n", keystrokes, repeats);
+  printf("%-10s %8s %9s %8s %10s %9s %9s\n",
+         "scenario", "events", "scans", "outputs", "checksum", "ns/scan", "ns/event");
+
+  const host::Scenario scenarios[] = {
+    host::Scenario::typing,
+    host::Scenario::rollover,
+    host::Scenario::mashing,
+    host::Scenario::tap_hold,
+  };
+  for (host::Scenario scenario : scenarios) {
+    Result r = runScenario(scenario, keystrokes, repeats);
+    printf("%-10s %8u %9u %8u   %08x %9.1f %9.1f\n",
+           host::scenarioName(scenario), r.events, r.scans, r.outputs, r.checksum,
+           r.best_ns / r.scans, r.best_ns / r.events);
+    if (qukeys::collect_stats) {
+      printStats(r.stats);
+    }
+    if (qukeys::batch_flush) {
+      printf("  batches: %u (%.2f events per batch)\n", r.batches,
+             double(r.outputs) / r.batches);
+    }
+    if (qukeys::adaptive_hold_timeout) {
+      printf("  adaptive hold timeout: tap p%u=%ums timeout=%ums\n",
+             unsigned(qukeys::adaptive_hold_percentile), r.hold_timeout.estimate(),
+             r.hold_timeout.timeout());
+    }
+  }
+  return 0;
+}
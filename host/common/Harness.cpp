@@ -0,0 +1,264 @@
+// -*- c++ -*-
+
+#include "Harness.h"
+
+#include <algorithm>
+
+#include <kaleidoglyph/cKey.h>
+
+namespace kaleidoglyph {
+namespace host {
+
+const PROGMEM qukeys::QukeyTable<11> test_qukeys = {{
+  {Key_A,            Key_LeftGui},       // 0
+  {Key_S,            Key_LeftAlt},       // 1
+  {Key_D,            Key_LeftControl},   // 2
+  {Key_F,            Key_LeftShift},     // 3
+  {Key_J,            Key_RightShift},    // 4
+  {Key_K,            Key_RightControl},  // 5
+  {Key_L,            Key_RightAlt},      // 6
+  {Key_Semicolon,    Key_RightGui},      // 7
+  {Key_LeftShift,    Key_Escape},        // 8 (SpaceCadet)
+  {layerShiftKey(1), Key_Spacebar},      // 9 (SpaceCadet layer shift)
+  {Key_Spacebar,     layerShiftKey(1)},  // 10 (layer shift on hold)
+}};
+
+const PROGMEM qukeys::QukeyProfile test_profiles[2] = {
+  {250, 200, 80},  // 1: pinkies
+  {120, 150, 50},  // 2: thumbs
+};
+
+const PROGMEM qukeys::QukeyTable<11> profiled_qukeys = {{
+  {Key_A,            Key_LeftGui,       1},  // 0
+  {Key_S,            Key_LeftAlt},           // 1
+  {Key_D,            Key_LeftControl},       // 2
+  {Key_F,            Key_LeftShift},         // 3
+  {Key_J,            Key_RightShift},        // 4
+  {Key_K,            Key_RightControl},      // 5
+  {Key_L,            Key_RightAlt,      3},  // 6 (out of range: global settings)
+  {Key_Semicolon,    Key_RightGui,      1},  // 7
+  {Key_LeftShift,    Key_Escape,        1},  // 8 (SpaceCadet)
+  {layerShiftKey(1), Key_Spacebar,      2},  // 9 (SpaceCadet layer shift)
+  {Key_Spacebar,     layerShiftKey(1),  2},  // 10 (layer shift on hold)
+}};
+
+void setupKeymap(Keymap& keymap) {
+  for (byte k{0}; k < total_keys; ++k) {
+    keymap.set(0, KeyAddr(k), keyboardKey(0x04 + (k % 36)));
+    // Populate the upper layers sparsely, so that lookups fall through as they would
+    // in a real layered keymap.
+    if (k % 3 == 0) {
+      keymap.set(1, KeyAddr(k), keyboardKey(0x1E + (k % 10)));
+    }
+  }
+  byte index{0};
+  for (byte addr : home_row_qukey_addrs) {
+    keymap.set(0, KeyAddr(addr), qukeys::QukeysKey(index++));
+  }
+  keymap.set(0, KeyAddr(spacecadet_qukey_addr), qukeys::QukeysKey(index++));
+  keymap.set(0, KeyAddr(thumb_qukey_addr), qukeys::QukeysKey(index++));
+  keymap.set(0, KeyAddr(layer_qukey_addr), qukeys::QukeysKey(index++));
+  keymap.set(0, KeyAddr(stray_qukey_addr), qukeys::QukeysKey(index + 1));
+}
+
+bool isQukeyAddr(byte addr) {
+  for (byte qukey_addr : home_row_qukey_addrs) {
+    if (addr == qukey_addr) {
+      return true;
+    }
+  }
+  return (addr == spacecadet_qukey_addr || addr == thumb_qukey_addr ||
+          addr == layer_qukey_addr);
+}
+
+const char* scenarioName(Scenario scenario) {
+  switch (scenario) {
+    case Scenario::typing:
+      return "typing";
+    case Scenario::rollover:
+      return "rollover";
+    case Scenario::mashing:
+      return "mashing";
+    case Scenario::tap_hold:
+      return "tap-hold";
+  }
+  return "?";
+}
+
+namespace {
+
+// xorshift32; deterministic across platforms, which std::uniform_int_distribution isn't.
+class Random {
+ public:
+  explicit Random(uint32_t seed) : state_(seed ? seed : 0x9E3779B9u) {}
+
+  uint32_t next() {
+    state_ ^= state_ << 13;
+    state_ ^= state_ >> 17;
+    state_ ^= state_ << 5;
+    return state_;
+  }
+  // Uniform-ish integer in [lo, hi].
+  uint32_t range(uint32_t lo, uint32_t hi) {
+    return lo + next() % (hi - lo + 1);
+  }
+  bool chance(uint32_t percent) {
+    return (next() % 100) < percent;
+  }
+
+ private:
+  uint32_t state_;
+};
+
+class SequenceBuilder {
+ public:
+  SequenceBuilder() {
+    for (uint32_t& t : free_at_) t = 0;
+  }
+
+  bool isFree(byte addr, uint32_t time) const { return free_at_[addr] <= time; }
+
+  // Record a keystroke; the key becomes free again one scan after its release.
+  void keystroke(byte addr, uint32_t press_time, uint32_t release_time) {
+    if (release_time <= press_time) release_time = press_time + 1;
+    events_.push_back({press_time, addr, true});
+    events_.push_back({release_time, addr, false});
+    free_at_[addr] = release_time + 1;
+  }
+
+  // Choose a key that is free at `time`, preferring qukeys with the given probability.
+  byte pickKey(Random& rng, uint32_t time, uint32_t qukey_percent) {
+    for (;;) {
+      byte addr;
+      if (rng.chance(qukey_percent)) {
+        addr = home_row_qukey_addrs[rng.range(0, sizeof(home_row_qukey_addrs) - 1)];
+      } else {
+        addr = rng.range(0, total_keys - 1);
+        if (isQukeyAddr(addr)) continue;
+      }
+      if (isFree(addr, time)) return addr;
+    }
+  }
+
+  EventSequence finish() {
+    std::stable_sort(events_.begin(), events_.end(),
+                     [](const TimedEvent& a, const TimedEvent& b) {
+                       return a.time < b.time;
+                     });
+    return events_;
+  }
+
+ private:
+  EventSequence events_;
+  uint32_t      free_at_[total_keys];
+};
+
+}  // namespace
+
+EventSequence generate(Scenario scenario, uint32_t keystrokes, uint32_t seed) {
+  Random          rng(seed);
+  SequenceBuilder builder;
+  uint32_t        t{0};
+
+  switch (scenario) {
+    case Scenario::typing:
+      for (uint32_t n{0}; n < keystrokes; ++n) {
+        byte addr = builder.pickKey(rng, t, 30);
+        builder.keystroke(addr, t, t + rng.range(50, 110));
+        t += rng.range(90, 220);
+      }
+      break;
+
+    case Scenario::rollover:
+      for (uint32_t n{0}; n < keystrokes; ++n) {
+        byte addr = builder.pickKey(rng, t, 35);
+        builder.keystroke(addr, t, t + rng.range(70, 160));
+        t += rng.range(15, 45);
+      }
+      break;
+
+    case Scenario::mashing:
+      for (uint32_t n{0}; n < keystrokes; ) {
+        for (byte k{0}; k < 12 && n < keystrokes; ++k, ++n) {
+          uint32_t press_time = t + rng.range(0, 10);
+          byte addr = builder.pickKey(rng, press_time, 40);
+          builder.keystroke(addr, press_time, press_time + rng.range(100, 300));
+        }
+        t += rng.range(320, 400);
+      }
+      break;
+
+    case Scenario::tap_hold:
+      for (uint32_t n{0}; n < keystrokes; ) {
+        byte qukey = builder.pickKey(rng, t, 100);
+        uint32_t choice = rng.range(0, 2);
+        if (choice == 0) {
+          // Plain tap followed by a quick re-press and hold (tap-hold).
+          uint32_t release = t + rng.range(40, 80);
+          uint32_t repress = release + rng.range(30, 90);
+          builder.keystroke(qukey, t, release);
+          builder.keystroke(qukey, repress, repress + rng.range(250, 400));
+          t = repress + 450;
+          n += 2;
+        } else if (choice == 1) {
+          // Qukey held as a modifier while another key is tapped.
+          uint32_t other_press = t + rng.range(30, 120);
+          uint32_t other_release = other_press + rng.range(40, 90);
+          byte other = builder.pickKey(rng, other_press, 0);
+          builder.keystroke(qukey, t, other_release + rng.range(10, 60));
+          builder.keystroke(other, other_press, other_release);
+          t = other_release + 150;
+          n += 2;
+        } else {
+          // Double tap.
+          uint32_t release = t + rng.range(40, 80);
+          uint32_t repress = release + rng.range(30, 90);
+          builder.keystroke(qukey, t, release);
+          builder.keystroke(qukey, repress, repress + rng.range(40, 80));
+          t = repress + 400;
+          n += 2;
+        }
+      }
+      break;
+  }
+  return builder.finish();
+}
+
+void setScanClock(uint16_t start_time, uint32_t time, uint32_t tick) {
+  Controller::setScanStartTime(uint16_t(start_time + time));
+  uint32_t ms = int16_t(start_time) + time;
+  Controller::setScanStartTicks(ms * qukeys::timestamp_ticks_per_ms + tick);
+}
+
+uint32_t runSequence(qukeys::Plugin& plugin, Controller& controller,
+                     const EventSequence& events,
+                     uint16_t start_time, uint32_t tail_scans) {
+  uint32_t end = events.empty() ? 0 : events.back().time;
+  end += tail_scans;
+
+  auto it = events.begin();
+  uint32_t scans{0};
+  for (uint32_t t{0}; t <= end; ++t) {
+    for (uint32_t tick{0}; tick < qukeys::timestamp_ticks_per_ms; ++tick, ++scans) {
+      setScanClock(start_time, t, tick);
+      plugin.preKeyswitchScan();
+      if (tick != 0) {
+        continue;
+      }
+      for (; it != events.end() && it->time == t; ++it) {
+        KeyEvent event;
+        event.addr   = KeyAddr(it->addr);
+        event.state  = it->press ? cKeyState::press : cKeyState::release;
+        event.key    = cKey::clear;
+        event.caller = EventHandlerId::controller;
+        if (plugin.onKeyswitchEvent(event) == EventHandlerResult::proceed) {
+          controller.handleKeyEvent(event);
+        }
+      }
+    }
+  }
+  return scans;
+}
+
+}  // namespace host
+}  // namespace kaleidoglyph
@@ -0,0 +1,124 @@
+// -*- c++ -*-
+
+// Shared pieces of the host tools: a 64-key test keymap with home-row qukeys, a
+// deterministic generator for timed keyswitch event sequences, and a driver that feeds
+// such a sequence through `qukeys::Plugin` one scan cycle at a time.
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <vector>
+
+#include <kaleidoglyph/Controller.h>
+#include <kaleidoglyph/KeyAddr.h>
+#include <kaleidoglyph/Keymap.h>
+#include <kaleidoglyph/cKey.h>
+
+#include "qukeys/Qukeys.h"
+
+namespace kaleidoglyph {
+namespace host {
+
+// A keyswitch event as it arrives from the matrix scan: `time` is the scan cycle (in
+// milliseconds since the start of the sequence) in which the event is reported.
+struct TimedEvent {
+  uint32_t time;
+  byte     addr;
+  bool     press;
+};
+
+typedef std::vector<TimedEvent> EventSequence;
+
+// Addresses of the qukeys in the test keymap: the eight home-row mod-taps, a SpaceCadet
+// shift/escape key, a SpaceCadet layer-shift/space thumb key, and a space/layer-shift
+// thumb key. Layer 1 has plain keys at every third address, including two of the
+// home-row qukeys'.
+constexpr byte home_row_qukey_addrs[] = {17, 18, 19, 20, 23, 24, 25, 26};
+constexpr byte spacecadet_qukey_addr{48};
+constexpr byte thumb_qukey_addr{56};
+constexpr byte layer_qukey_addr{57};
+
+// Address of a `QukeysKey` whose index is past the end of the qukey tables, as a keymap
+// built without `QukeyTable::key()` could have. It's typed like any other key.
+constexpr byte stray_qukey_addr{62};
+
+extern const qukeys::QukeyTable<11> test_qukeys;
+
+// The same qukeys, with per-qukey timing profiles for the pinkies and the thumb.
+extern const qukeys::QukeyProfile test_profiles[2];
+extern const qukeys::QukeyTable<11> profiled_qukeys;
+
+// Multi-tap keys for three of the test qukeys: one with keys for two and three taps, one
+// with a key for two taps only, and the SpaceCadet thumb key. `useMultiTaps()` gives them
+// to an engine, but only if it's built with a `multi_tap_max` of at least 3 (so that the
+// table fits); otherwise, it does nothing.
+template <byte _multi_tap_max = qukeys::multi_tap_max, bool = (_multi_tap_max >= 3)>
+struct TestMultiTaps {
+  static const qukeys::MultiTapTable<3> table;
+  template <typename _Engine>
+  static void use(_Engine& engine) {
+    engine.setMultiTaps(table);
+  }
+};
+template <byte _multi_tap_max>
+struct TestMultiTaps<_multi_tap_max, false> {
+  template <typename _Engine>
+  static void use(_Engine&) {}
+};
+template <byte _multi_tap_max, bool _enabled>
+const PROGMEM qukeys::MultiTapTable<3> TestMultiTaps<_multi_tap_max, _enabled>::table = {{
+  {0, Key_Escape, Key_Tab},   // A/gui
+  {4, Key_Enter},             // J/shift
+  {9, Key_Backspace},         // layer shift/space
+}};
+
+template <typename _Engine>
+void useMultiTaps(_Engine& engine) {
+  TestMultiTaps<>::use(engine);
+}
+
+void setupKeymap(Keymap& keymap);
+
+bool isQukeyAddr(byte addr);
+
+// Sequence generators. Every sequence is physically consistent: a key is never pressed
+// twice without a release in between, and every press is eventually released.
+enum class Scenario : byte {
+  typing,    // one key at a time, little overlap, ~30% qukeys
+  rollover,  // fast typing with three to five keys down at once
+  mashing,   // bursts of a dozen simultaneous presses, overflowing the queue
+  tap_hold,  // qukey taps, tap-holds and qukeys held as modifiers
+};
+
+const char* scenarioName(Scenario scenario);
+
+EventSequence generate(Scenario scenario, uint32_t keystrokes, uint32_t seed);
+
+// Set the controller's scan clocks to tick `tick` of the millisecond `time` after
+// `start_time`: `Controller::scanStartTime()` to that millisecond, and
+// `Controller::scanStartTicks()` to the count of `qukeys::timestamp_ticks_per_ms` ticks
+// per millisecond, which starts out just as far short of its wraparound (at 2^32) as
+// the millisecond clock does (at 2^16), if it's in the upper half of its range.
+void setScanClock(uint16_t start_time, uint32_t time, uint32_t tick = 0);
+
+// The current scan time, from the clock that Qukeys' timestamps come from.
+inline qukeys::Timestamp scanTime() {
+  return (qukeys::timestamp_ticks_per_ms > 1) ? Controller::scanStartTicks()
+                                              : Controller::scanStartTime();
+}
+
+// Feed `events` through `plugin`, one scan cycle per millisecond (or per tick, with
+// more than one `qukeys::timestamp_ticks_per_ms`), calling `preKeyswitchScan()` at the
+// start of every cycle and `onKeyswitchEvent()` for each event reported in that cycle
+// (the first one of its millisecond). Events that the plugin lets proceed are passed
+// on to `controller`, as the next handler in the chain would receive them. The scan
+// clock starts at `start_time`, so sequences can be made to cross the timestamp
+// wraparound. After the last event, the driver keeps scanning for `tail_scans`
+// milliseconds so that all timeouts can expire. Returns the number of scan cycles run.
+uint32_t runSequence(qukeys::Plugin& plugin, Controller& controller,
+                     const EventSequence& events,
+                     uint16_t start_time = 0, uint32_t tail_scans = 1000);
+
+}  // namespace host
+}  // namespace kaleidoglyph
@@ -0,0 +1,149 @@
+// -*- c++ -*-
+
+#include "Trace.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace kaleidoglyph {
+namespace host {
+
+namespace {
+
+void put16(byte* p, uint16_t value) {
+  p[0] = value & 0xFF;
+  p[1] = value >> 8;
+}
+void put32(byte* p, uint32_t value) {
+  put16(p, value & 0xFFFF);
+  put16(p + 2, value >> 16);
+}
+uint16_t get16(const byte* p) {
+  return p[0] | (uint16_t(p[1]) << 8);
+}
+uint32_t get32(const byte* p) {
+  return get16(p) | (uint32_t(get16(p + 2)) << 16);
+}
+
+}  // namespace
+
+bool TraceWriter::open(const char* path, uint32_t magic) {
+  close();
+  file_ = fopen(path, "wb");
+  if (file_ == nullptr) {
+    perror(path);
+    return false;
+  }
+  // A large stdio buffer keeps the per-record cost down to a memcpy.
+  setvbuf(file_, nullptr, _IOFBF, 1 << 20);
+  record_size_ = (magic == trace_output_magic) ? trace_output_record_size
+                                               : trace_input_record_size;
+  byte header[trace_header_size];
+  put32(header, magic);
+  put16(header + 4, trace_version);
+  put16(header + 6, record_size_);
+  ok_ = (fwrite(header, sizeof(header), 1, file_) == 1);
+  return ok_;
+}
+
+bool TraceWriter::close() {
+  if (file_ == nullptr) {
+    return true;
+  }
+  bool ok = ok_ && (fclose(file_) == 0);
+  file_ = nullptr;
+  return ok;
+}
+
+void TraceWriter::writeInput(uint16_t time, byte addr, bool press) {
+  byte record[trace_input_record_size];
+  put16(record, time);
+  record[2] = (addr & 0x7F) | (press ? 0x80 : 0);
+  ok_ = ok_ && (fwrite(record, sizeof(record), 1, file_) == 1);
+}
+
+void TraceWriter::writeOutput(uint16_t time, const KeyEvent& event) {
+  byte record[trace_output_record_size];
+  bool press = event.state.toggledOn();
+  put16(record, time);
+  record[2] = (event.addr.addr() & 0x7F) | (press ? 0x80 : 0);
+  put16(record + 3, press ? event.key.raw() : 0);
+  ok_ = ok_ && (fwrite(record, sizeof(record), 1, file_) == 1);
+}
+
+bool TraceReader::open(const char* path) {
+  close();
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    perror(path);
+    ::close(fd);
+    return false;
+  }
+  size_ = st.st_size;
+  if (size_ < trace_header_size) {
+    fprintf(stderr, "%s: too short to be a trace\n", path);
+    ::close(fd);
+    return false;
+  }
+  void* map = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    perror(path);
+    return false;
+  }
+  madvise(map, size_, MADV_SEQUENTIAL);
+  data_ = static_cast<const byte*>(map);
+
+  if (get32(data_) != trace_input_magic || get16(data_ + 4) != trace_version ||
+      get16(data_ + 6) != trace_input_record_size) {
+    fprintf(stderr, "%s: not a version %u input trace\n", path, trace_version);
+    close();
+    return false;
+  }
+  record_count_ = (size_ - trace_header_size) / trace_input_record_size;
+  index_ = 0;
+  last_time_ = (record_count_ > 0) ? get16(data_ + trace_header_size) : 0;
+  return true;
+}
+
+void TraceReader::close() {
+  if (data_ != nullptr) {
+    munmap(const_cast<byte*>(data_), size_);
+    data_ = nullptr;
+  }
+}
+
+bool TraceReader::next(TraceEvent& event) {
+  if (index_ == record_count_) {
+    return false;
+  }
+  const byte* record = data_ + trace_header_size + index_ * trace_input_record_size;
+  ++index_;
+  uint16_t delta = get16(record) - uint16_t(last_time_);
+  last_time_ += delta;
+  event.time  = last_time_;
+  event.addr  = record[2] & 0x7F;
+  event.press = (record[2] & 0x80) != 0;
+  return true;
+}
+
+bool writeSequence(const char* path, const EventSequence& events, uint16_t start_time) {
+  TraceWriter writer;
+  if (!writer.open(path, trace_input_magic)) {
+    return false;
+  }
+  for (const TimedEvent& event : events) {
+    writer.writeInput(uint16_t(start_time + event.time), event.addr, event.press);
+  }
+  return writer.close();
+}
+
+}  // namespace host
+}  // namespace kaleidoglyph
@@ -0,0 +1,99 @@
+// -*- c++ -*-
+
+// Binary keyswitch event traces.
+//
+// A trace file is an 8-byte header followed by fixed-size little-endian records. The
+// header is a 4-byte magic number, a 16-bit format version, and a 16-bit record size.
+//
+// An input trace ("QKTI") records keyswitch events as the matrix scan reported them, in
+// 3 bytes each:
+//
+//   bytes 0-1  scan start time (milliseconds, 16 bits, wrapping)
+//   byte  2    key address in the low 7 bits; the high bit is set for a press
+//
+// A resolved trace ("QKTO") records the events Qukeys sent on to the controller, in 5
+// bytes each: the same 3 bytes (with the time the event was sent), followed by the
+// 16-bit `Key` value (zero for releases).
+//
+// Timestamps are unwrapped on reading by assuming that consecutive records are less than
+// 65536ms apart; a recorder that sees a longer gap should insert a release of an unused
+// key address to bridge it. Keyboards with more than 128 keys can't be recorded.
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <stdio.h>
+
+#include <kaleidoglyph/Key.h>
+#include <kaleidoglyph/KeyEvent.h>
+
+#include "Harness.h"
+
+namespace kaleidoglyph {
+namespace host {
+
+constexpr uint32_t trace_input_magic{0x49544B51};   // "QKTI"
+constexpr uint32_t trace_output_magic{0x4F544B51};  // "QKTO"
+constexpr uint16_t trace_version{1};
+constexpr byte     trace_header_size{8};
+constexpr byte     trace_input_record_size{3};
+constexpr byte     trace_output_record_size{5};
+
+// A decoded input record, with its timestamp unwrapped.
+struct TraceEvent {
+  uint64_t time;
+  byte     addr;
+  bool     press;
+};
+
+// Sequential, buffered trace writer.
+class TraceWriter {
+ public:
+  TraceWriter() = default;
+  ~TraceWriter() { close(); }
+
+  bool open(const char* path, uint32_t magic);
+  bool close();
+
+  void writeInput(uint16_t time, byte addr, bool press);
+  void writeOutput(uint16_t time, const KeyEvent& event);
+
+ private:
+  FILE*    file_{nullptr};
+  uint16_t record_size_{0};
+  bool     ok_{true};
+};
+
+// Memory-mapped trace reader. Records are decoded one at a time straight from the
+// mapping, so a trace is never loaded into memory as a whole, and the kernel's
+// read-ahead does the I/O.
+class TraceReader {
+ public:
+  TraceReader() = default;
+  ~TraceReader() { close(); }
+
+  // Returns false (and prints the reason) if the file can't be mapped, or isn't an input
+  // trace.
+  bool open(const char* path);
+  void close();
+
+  uint64_t recordCount() const { return record_count_; }
+
+  // Decode the next record into `event`, with its timestamp unwrapped to a 64-bit
+  // millisecond count. Returns false at the end of the trace.
+  bool next(TraceEvent& event);
+
+ private:
+  const byte* data_{nullptr};
+  size_t      size_{0};
+  uint64_t    record_count_{0};
+  uint64_t    index_{0};
+  uint64_t    last_time_{0};
+};
+
+// Write a generated event sequence as an input trace, starting at `start_time`.
+bool writeSequence(const char* path, const EventSequence& events, uint16_t start_time);
+
+}  // namespace host
+}  // namespace kaleidoglyph
@@ -0,0 +1,18 @@
+// -*- c++ -*-
+
+// Host stand-in for the parts of the Arduino core that Kaleidoglyph-Qukeys uses. The
+// bit macros match the AVR core's definitions, including their use of `1UL`.
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+typedef uint8_t byte;
+
+#define PROGMEM
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
@@ -0,0 +1,64 @@
+// -*- c++ -*-
+
+#include "kaleidoglyph/Controller.h"
+
+namespace kaleidoglyph {
+
+uint16_t Controller::scan_start_time_{0};
+uint32_t Controller::scan_start_ticks_{0};
+
+void Controller::handleKeyEvent(KeyEvent event) {
+  ++batch_count_;
+  record(event);
+  shiftLayers(event);
+}
+
+void Controller::handleKeyEvents(const KeyEvent* events, byte count) {
+  ++batch_count_;
+  for (byte i{0}; i < count; ++i) {
+    record(events[i]);
+    shiftLayers(events[i]);
+  }
+}
+
+void Controller::record(const KeyEvent& event) {
+  ++event_count_;
+  // Only presses carry a meaningful `key`; releases are looked up downstream.
+  uint32_t value = (uint32_t(event.addr.addr()) << 24) |
+                   (uint32_t(event.state.toggledOn()) << 16) |
+                   (event.state.toggledOn() ? event.key.raw() : 0);
+  // FNV-1a style fold, so the checksum depends on event order.
+  checksum_ = (checksum_ ^ value) * 16777619u;
+  if (log_ != nullptr) {
+    log_->push_back(event);
+  }
+  if (sink_ != nullptr) {
+    sink_(event, sink_context_);
+  }
+}
+
+// A press without a value gets looked up in the keymap, as the controller would; a
+// release always gets the value its key was pressed with.
+void Controller::shiftLayers(const KeyEvent& event) {
+  if (keymap_ == nullptr) {
+    return;
+  }
+  byte addr = event.addr.addr();
+  Key  key  = active_keys_[addr];
+  if (event.state.toggledOn()) {
+    key = (event.key == cKey::clear) ? (*keymap_)[event.addr] : event.key;
+    active_keys_[addr] = key;
+  } else {
+    active_keys_[addr] = cKey::clear;
+  }
+  if (isLayerShiftKey(key)) {
+    byte layer = key.raw() & 0xFF;
+    if (event.state.toggledOn()) {
+      keymap_->activateLayer(layer);
+    } else {
+      keymap_->deactivateLayer(layer);
+    }
+  }
+}
+
+}  // namespace kaleidoglyph
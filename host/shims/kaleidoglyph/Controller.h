@@ -0,0 +1,72 @@
+// -*- c++ -*-
+
+// Host stand-in for `kaleidoglyph/Controller.h`. Instead of running the rest of the
+// plugin chain, `handleKeyEvent()` counts the events it receives, folds them into a
+// checksum, and (optionally) appends them to a log or passes them to a sink function,
+// so the host tools can compare output streams between builds. `handleKeyEvents()`
+// does the same for a run of events, which counts as a single batch (i.e. one report,
+// where each `handleKeyEvent()` call is one). Given a keymap, it also does the one thing
+// the rest of the chain would do that Qukeys can see: a layer shift key's press
+// activates its layer in the keymap, and its release deactivates it again.
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <vector>
+
+#include "kaleidoglyph/KeyEvent.h"
+#include "kaleidoglyph/Keymap.h"
+
+namespace kaleidoglyph {
+
+class Controller {
+ public:
+  static uint16_t scanStartTime() { return scan_start_time_; }
+  static void setScanStartTime(uint16_t time) { scan_start_time_ = time; }
+  static uint32_t scanStartTicks() { return scan_start_ticks_; }
+  static void setScanStartTicks(uint32_t ticks) { scan_start_ticks_ = ticks; }
+
+  void handleKeyEvent(KeyEvent event);
+  void handleKeyEvents(const KeyEvent* events, byte count);
+
+  uint32_t eventCount() const { return event_count_; }
+  uint32_t batchCount() const { return batch_count_; }
+  uint32_t checksum() const { return checksum_; }
+
+  typedef void (*Sink)(const KeyEvent& event, void* context);
+
+  void setKeymap(Keymap* keymap) { keymap_ = keymap; }
+  void setLog(std::vector<KeyEvent>* log) { log_ = log; }
+  void setSink(Sink sink, void* context) {
+    sink_         = sink;
+    sink_context_ = context;
+  }
+  void reset() {
+    event_count_ = 0;
+    batch_count_ = 0;
+    checksum_    = 0;
+  }
+
+ private:
+  static uint16_t scan_start_time_;
+  static uint32_t scan_start_ticks_;
+
+  void record(const KeyEvent& event);
+  void shiftLayers(const KeyEvent& event);
+
+  uint32_t               event_count_{0};
+  uint32_t               batch_count_{0};
+  uint32_t               checksum_{0};
+  std::vector<KeyEvent>* log_{nullptr};
+  Sink                   sink_{nullptr};
+  void*                  sink_context_{nullptr};
+
+  // The keymap that layer shifts are applied to, and the value each key was pressed
+  // with (which is what its release applies to, as with a real controller's active
+  // keys)
+  Keymap* keymap_{nullptr};
+  Key     active_keys_[total_keys] = {};
+};
+
+}  // namespace kaleidoglyph
@@ -0,0 +1,16 @@
+// -*- c++ -*-
+
+// Host stand-in for `kaleidoglyph/EventHandlerId.h`.
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace kaleidoglyph {
+
+enum class EventHandlerId : byte {
+  controller,
+  qukeys,
+};
+
+}  // namespace kaleidoglyph
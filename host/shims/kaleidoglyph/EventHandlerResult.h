@@ -0,0 +1,16 @@
+// -*- c++ -*-
+
+// Host stand-in for `kaleidoglyph/EventHandlerResult.h`.
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace kaleidoglyph {
+
+enum class EventHandlerResult : byte {
+  proceed,
+  abort,
+};
+
+}  // namespace kaleidoglyph
@@ -0,0 +1,46 @@
+// -*- c++ -*-
+
+// Host stand-in for `kaleidoglyph/Key.h`. A `Key` is a 16-bit value; keyboard keys use
+// the low byte for the HID keycode, layer shifts set bit 14, and plugin keys set bit 15
+// with the plugin's type id in bits 8-14.
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace kaleidoglyph {
+
+class Key {
+ public:
+  Key() = default;
+  constexpr explicit
+  Key(uint16_t raw) : raw_(raw) {}
+
+  constexpr uint16_t raw() const { return raw_; }
+
+  constexpr bool operator==(const Key other) const { return raw_ == other.raw_; }
+  constexpr bool operator!=(const Key other) const { return raw_ != other.raw_; }
+
+ private:
+  uint16_t raw_;
+};
+
+constexpr uint16_t layer_shift_key_flag{0x4000};
+constexpr uint16_t plugin_key_flag{0x8000};
+
+constexpr
+bool isModifierKey(Key key) {
+  return (key.raw() >= 0xE0 && key.raw() <= 0xE7);
+}
+
+constexpr
+bool isLayerShiftKey(Key key) {
+  return ((key.raw() & 0xFF00) == layer_shift_key_flag);
+}
+
+constexpr
+bool isKeyboardKey(Key key) {
+  return ((key.raw() & (layer_shift_key_flag | plugin_key_flag)) == 0);
+}
+
+}  // namespace kaleidoglyph
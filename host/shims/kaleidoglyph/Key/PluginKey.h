@@ -0,0 +1,35 @@
+// -*- c++ -*-
+
+// Host stand-in for `kaleidoglyph/Key/PluginKey.h`.
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "kaleidoglyph/Key.h"
+
+namespace kaleidoglyph {
+
+template <byte _type_id>
+class PluginKey {
+ public:
+  constexpr
+  PluginKey(byte data) : data_(data) {}
+  constexpr explicit
+  PluginKey(Key key) : data_(key.raw() & 0xFF) {}
+
+  constexpr byte data() const { return data_; }
+
+  constexpr operator Key() const {
+    return Key(plugin_key_flag | (uint16_t(_type_id) << 8) | data_);
+  }
+
+  static constexpr bool verifyType(Key key) {
+    return ((key.raw() & 0xFF00) == (plugin_key_flag | (uint16_t(_type_id) << 8)));
+  }
+
+ private:
+  byte data_;
+};
+
+}  // namespace kaleidoglyph
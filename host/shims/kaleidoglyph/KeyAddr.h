@@ -0,0 +1,28 @@
+// -*- c++ -*-
+
+// Host stand-in for `kaleidoglyph/KeyAddr.h`, sized for a 64-key board.
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace kaleidoglyph {
+
+constexpr byte total_keys{64};
+
+class KeyAddr {
+ public:
+  KeyAddr() = default;
+  constexpr explicit
+  KeyAddr(byte addr) : addr_(addr) {}
+
+  constexpr byte addr() const { return addr_; }
+
+  constexpr bool operator==(const KeyAddr other) const { return addr_ == other.addr_; }
+  constexpr bool operator!=(const KeyAddr other) const { return addr_ != other.addr_; }
+
+ private:
+  byte addr_;
+};
+
+}  // namespace kaleidoglyph
@@ -0,0 +1,21 @@
+// -*- c++ -*-
+
+// Host stand-in for `kaleidoglyph/KeyArray.h`.
+
+#pragma once
+
+#include "kaleidoglyph/Key.h"
+#include "kaleidoglyph/KeyAddr.h"
+
+namespace kaleidoglyph {
+
+class KeyArray {
+ public:
+  Key& operator[](KeyAddr k) { return keys_[k.addr()]; }
+  Key  operator[](KeyAddr k) const { return keys_[k.addr()]; }
+
+ private:
+  Key keys_[total_keys];
+};
+
+}  // namespace kaleidoglyph
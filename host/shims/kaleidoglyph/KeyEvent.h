@@ -0,0 +1,21 @@
+// -*- c++ -*-
+
+// Host stand-in for `kaleidoglyph/KeyEvent.h`.
+
+#pragma once
+
+#include "kaleidoglyph/EventHandlerId.h"
+#include "kaleidoglyph/Key.h"
+#include "kaleidoglyph/KeyAddr.h"
+#include "kaleidoglyph/KeyState.h"
+
+namespace kaleidoglyph {
+
+struct KeyEvent {
+  KeyAddr        addr;
+  KeyState       state;
+  Key            key;
+  EventHandlerId caller;
+};
+
+}  // namespace kaleidoglyph
@@ -0,0 +1,39 @@
+// -*- c++ -*-
+
+// Host stand-in for `kaleidoglyph/KeyState.h`.
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace kaleidoglyph {
+
+class KeyState {
+ public:
+  KeyState() = default;
+  constexpr explicit
+  KeyState(byte state) : state_(state) {}
+
+  constexpr bool isPressed() const { return (state_ & is_pressed) != 0; }
+  constexpr bool wasPressed() const { return (state_ & was_pressed) != 0; }
+  constexpr bool toggledOn() const { return isPressed() && !wasPressed(); }
+  constexpr bool toggledOff() const { return wasPressed() && !isPressed(); }
+
+  constexpr bool operator==(const KeyState other) const { return state_ == other.state_; }
+  constexpr bool operator!=(const KeyState other) const { return state_ != other.state_; }
+
+  static constexpr byte is_pressed{0b01};
+  static constexpr byte was_pressed{0b10};
+
+ private:
+  byte state_;
+};
+
+namespace cKeyState {
+
+constexpr KeyState press{KeyState::is_pressed};
+constexpr KeyState release{KeyState::was_pressed};
+
+}  // namespace cKeyState
+
+}  // namespace kaleidoglyph
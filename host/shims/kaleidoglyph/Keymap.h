@@ -0,0 +1,51 @@
+// -*- c++ -*-
+
+// Host stand-in for `kaleidoglyph/Keymap.h`: a small layered keymap. A lookup walks
+// down from the highest active layer until it finds a non-transparent key, which is
+// what makes a real keymap lookup cost more than an array index.
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "kaleidoglyph/Key.h"
+#include "kaleidoglyph/KeyAddr.h"
+#include "kaleidoglyph/cKey.h"
+
+namespace kaleidoglyph {
+
+class Keymap {
+ public:
+  static constexpr byte max_layers{4};
+
+  Keymap() {
+    for (byte layer{0}; layer < max_layers; ++layer) {
+      for (byte k{0}; k < total_keys; ++k) {
+        keys_[layer][k] = cKey::transparent;
+      }
+    }
+  }
+
+  Key operator[](KeyAddr k) const {
+    for (byte layer{max_layers}; layer-- > 0; ) {
+      if (bitRead(active_layers_, layer)) {
+        Key key = keys_[layer][k.addr()];
+        if (key != cKey::transparent) {
+          return key;
+        }
+      }
+    }
+    return cKey::clear;
+  }
+
+  void set(byte layer, KeyAddr k, Key key) { keys_[layer][k.addr()] = key; }
+
+  void activateLayer(byte layer) { bitSet(active_layers_, layer); }
+  void deactivateLayer(byte layer) { bitClear(active_layers_, layer); }
+
+ private:
+  Key  keys_[max_layers][total_keys];
+  byte active_layers_{1};
+};
+
+}  // namespace kaleidoglyph
@@ -0,0 +1,11 @@
+// -*- c++ -*-
+
+// Host stand-in for `kaleidoglyph/Plugin.h`.
+
+#pragma once
+
+namespace kaleidoglyph {
+
+class EventHandler {};
+
+}  // namespace kaleidoglyph
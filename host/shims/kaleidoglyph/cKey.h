@@ -0,0 +1,44 @@
+// -*- c++ -*-
+
+// Host stand-in for `kaleidoglyph/cKey.h`, plus the handful of keyboard and layer keys
+// used by the host tools.
+
+#pragma once
+
+#include "kaleidoglyph/Key.h"
+
+namespace kaleidoglyph {
+namespace cKey {
+
+constexpr Key clear{0x0000};
+constexpr Key transparent{0x0001};
+
+}  // namespace cKey
+
+constexpr Key keyboardKey(byte keycode) { return Key(keycode); }
+constexpr Key layerShiftKey(byte layer) { return Key(layer_shift_key_flag | layer); }
+
+constexpr Key Key_A{0x04};
+constexpr Key Key_D{0x07};
+constexpr Key Key_F{0x09};
+constexpr Key Key_J{0x0D};
+constexpr Key Key_K{0x0E};
+constexpr Key Key_L{0x0F};
+constexpr Key Key_S{0x16};
+constexpr Key Key_Semicolon{0x33};
+constexpr Key Key_Spacebar{0x2C};
+constexpr Key Key_Escape{0x29};
+constexpr Key Key_Enter{0x28};
+constexpr Key Key_Backspace{0x2A};
+constexpr Key Key_Tab{0x2B};
+
+constexpr Key Key_LeftControl{0xE0};
+constexpr Key Key_LeftShift{0xE1};
+constexpr Key Key_LeftAlt{0xE2};
+constexpr Key Key_LeftGui{0xE3};
+constexpr Key Key_RightControl{0xE4};
+constexpr Key Key_RightShift{0xE5};
+constexpr Key Key_RightAlt{0xE6};
+constexpr Key Key_RightGui{0xE7};
+
+}  // namespace kaleidoglyph
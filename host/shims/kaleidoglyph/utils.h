@@ -0,0 +1,15 @@
+// -*- c++ -*-
+
+// Host stand-in for `kaleidoglyph/utils.h`. There is no separate program memory on the
+// host, so reading from "PROGMEM" is a plain copy.
+
+#pragma once
+
+namespace kaleidoglyph {
+
+template <typename _Type>
+_Type readFromProgmem(const _Type& pgm_object) {
+  return pgm_object;
+}
+
+}  // namespace kaleidoglyph
@@ -0,0 +1,382 @@
+// -*- c++ -*-
+
+#include "ReferenceEngine.h"
+
+#include <algorithm>
+
+#include "Harness.h"
+
+namespace kaleidoglyph {
+namespace host {
+
+namespace {
+
+bool isSpaceCadet(const qukeys::Qukey& qukey) {
+  return isModifierKey(qukey.primaryKey()) || isLayerShiftKey(qukey.primaryKey());
+}
+
+}  // namespace
+
+EventHandlerResult ReferenceEngine::onKeyswitchEvent(KeyEvent& event) {
+  sources_[qukeys::keySource(event.addr.addr())].queue.push_back(
+      {event.addr, event.state.toggledOff(), host::scanTime()});
+  flush();
+  return EventHandlerResult::abort;
+}
+
+// A new scan cycle starts a new flush budget, and each source's head qukey gets its hold
+// timeout checked, oldest first.
+void ReferenceEngine::preKeyswitchScan() {
+  flush_time_ = host::scanTime();
+  flushed_    = 0;
+  flush();
+  for (Source* source : sourcesByAge()) {
+    source_ = source;
+    std::vector<QueuedEvent>& queue = source_->queue;
+    if (source_->release_delayed_for_tap_hold || !withinFlushBudget()) {
+      continue;
+    }
+    qukeys::Qukey qukey = lookup(keymap_[queue[0].addr]);
+    qukeys::Timestamp elapsed = host::scanTime() - queue[0].time;
+    if (elapsed < holdTimeout(qukey)) {
+      continue;
+    }
+    KeyEvent event;
+    event.addr  = queue[0].addr;
+    event.state = cKeyState::press;
+    event.key   = isSpaceCadet(qukey) ? qukey.primaryKey() : qukey.alternateKey();
+    queue.erase(queue.begin());
+    send(event);
+  }
+}
+
+// The sources with anything in their queues, the one whose first event is oldest first
+// (the lowest-numbered one, on a tie).
+std::vector<ReferenceEngine::Source*> ReferenceEngine::sourcesByAge() {
+  std::vector<Source*> sources;
+  for (Source& source : sources_) {
+    if (!source.queue.empty()) {
+      sources.push_back(&source);
+    }
+  }
+  qukeys::Timestamp now = host::scanTime();
+  std::stable_sort(sources.begin(), sources.end(), [now](Source* a, Source* b) {
+      return qukeys::Timestamp(now - a->queue[0].time) >
+             qukeys::Timestamp(now - b->queue[0].time);
+    });
+  return sources;
+}
+
+// At most `flush_budget` events are flushed per scan cycle, unless the queue is full.
+bool ReferenceEngine::withinFlushBudget() const {
+  const std::vector<QueuedEvent>& queue = source_->queue;
+  return qukeys::flush_budget == 0 || flushed_ < qukeys::flush_budget ||
+         queue.size() == qukeys::queue_max;
+}
+
+void ReferenceEngine::flush() {
+  if (host::scanTime() != flush_time_) {
+    flush_time_ = host::scanTime();
+    flushed_    = 0;
+  }
+  // Each event flushed comes from the source with the oldest first event that has one to
+  // flush.
+  for (bool flushed{true}; flushed;) {
+    flushed = false;
+    for (Source* source : sourcesByAge()) {
+      source_ = source;
+      KeyEvent event;
+      if (withinFlushBudget() && nextFlushEvent(event)) {
+        send(event);
+        flushed = true;
+        break;
+      }
+    }
+  }
+}
+
+bool ReferenceEngine::nextFlushEvent(KeyEvent& event) {
+  std::vector<QueuedEvent>& queue = source_->queue;
+  if (queue.empty()) {
+    return false;
+  }
+  event.addr  = queue[0].addr;
+  event.state = queue[0].release ? cKeyState::release : cKeyState::press;
+  event.key   = cKey::clear;
+
+  if (queue[0].release) {
+    if (waitingForTapHold()) {
+      return false;
+    }
+    source_->release_delayed_for_tap_hold = false;
+    // The end of a multi-tap count: the press comes first.
+    if (source_->taps != 0) {
+      event.state = cKeyState::press;
+      event.key   = multiTapKey();
+      source_->taps = 0;
+      return true;
+    }
+    queue.erase(queue.begin());
+    return true;
+  }
+
+  event.key = keymap_[queue[0].addr];
+  if (!qukeys::isQukeysKey(event.key)) {
+    queue.erase(queue.begin());
+    return true;
+  }
+  qukeys::Qukey qukey = lookup(event.key);
+  if (!active_) {
+    event.key = qukey.primaryKey();
+    queue.erase(queue.begin());
+    return true;
+  }
+  bool spacecadet = isSpaceCadet(qukey);
+  byte overlap_required = profile(qukey).overlapRequired();
+
+  size_t next_keypress{0};
+  size_t delayed_release{0};
+  for (size_t i{1}; i < queue.size(); ++i) {
+    if (qukeys::concurrent_resolution &&
+        timedOut(qukey, next_keypress, delayed_release, queue[i].time, event.key)) {
+      queue.erase(queue.begin());
+      return true;
+    }
+    if (!queue[i].release) {
+      if (spacecadet) {
+        event.key = qukey.primaryKey();
+        queue.erase(queue.begin());
+        return true;
+      }
+      if (qukeys::bilateral_resolution &&
+          qukeys::keyZone(queue[i].addr.addr()) == qukeys::keyZone(event.addr.addr())) {
+        event.key = qukey.primaryKey();
+        queue.erase(queue.begin());
+        return true;
+      }
+      if (next_keypress == 0) {
+        next_keypress = i;
+      }
+      continue;
+    }
+    if (queue[i].addr == event.addr) {
+      if (next_keypress == 0 || overlap_required == 0) {
+        if (queue.size() == 2) {
+          source_->release_delayed_for_tap_hold = true;
+          startMultiTap(qukeys::QukeysKey(event.key).data());
+        }
+        event.key = spacecadet ? qukey.alternateKey() : qukey.primaryKey();
+        learnTap(qukey, queue[i].time - queue[0].time);
+        queue.erase(queue.begin());
+        if (source_->taps != 0) {
+          return nextFlushEvent(event);
+        }
+        return true;
+      }
+      if (qukeys::concurrent_resolution) {
+        if (delayed_release == 0) {
+          delayed_release = i;
+        }
+        continue;
+      }
+      if (releaseDelayed(queue[next_keypress].time, queue[i].time, overlap_required)) {
+        continue;
+      }
+      event.key = qukey.primaryKey();
+      learnTap(qukey, queue[i].time - queue[0].time);
+      queue.erase(queue.begin());
+      return true;
+    }
+    for (size_t j{1}; j < i; ++j) {
+      if (!queue[j].release && queue[j].addr == queue[i].addr) {
+        event.key = qukey.alternateKey();
+        queue.erase(queue.begin());
+        return true;
+      }
+    }
+    if (qukeys::flush_unrelated_releases) {
+      Key key = keymap_[queue[i].addr];
+      if (!isModifierKey(key) && !isLayerShiftKey(key) && !qukeys::isQukeysKey(key)) {
+        event.addr  = queue[i].addr;
+        event.state = cKeyState::release;
+        event.key   = key;
+        queue.erase(queue.begin() + i);
+        return true;
+      }
+    }
+  }
+
+  if (qukeys::concurrent_resolution &&
+      timedOut(qukey, next_keypress, delayed_release, host::scanTime(),
+               event.key)) {
+    queue.erase(queue.begin());
+    return true;
+  }
+
+  if (queue.size() == qukeys::queue_max) {
+    event.key = qukey.primaryKey();
+    queue.erase(queue.begin());
+    return true;
+  }
+  return false;
+}
+
+bool ReferenceEngine::releaseDelayed(qukeys::Timestamp overlap_start,
+                                     qukeys::Timestamp overlap_end,
+                                     byte overlap_required) const {
+  qukeys::Timestamp elapsed = host::scanTime() - overlap_end;
+  return (elapsed < releaseTimeout(overlap_start, overlap_end, overlap_required));
+}
+
+// At most 255ms, in ticks.
+qukeys::Timestamp ReferenceEngine::releaseTimeout(qukeys::Timestamp overlap_start,
+                                                  qukeys::Timestamp overlap_end,
+                                                  byte overlap_required) const {
+  qukeys::Timestamp overlap_duration = overlap_end - overlap_start;
+  uint64_t limit = (uint64_t(overlap_duration) * 100) / overlap_required;
+  limit -= overlap_duration;
+  return std::min<uint64_t>(limit, 255 * qukeys::timestamp_ticks_per_ms);
+}
+
+// With `concurrent_resolution`, the head qukey's timeouts are measured against event
+// timestamps: if its hold timeout or its (first) delayed release's timeout expired by
+// `time`, whichever expired first (the release, on a tie) determines `key`.
+bool ReferenceEngine::timedOut(const qukeys::Qukey& qukey, size_t next_keypress,
+                               size_t delayed_release, qukeys::Timestamp time,
+                               Key& key) {
+  std::vector<QueuedEvent>& queue = source_->queue;
+  qukeys::Timestamp elapsed = time - queue[0].time;
+  qukeys::Timestamp hold = holdTimeout(qukey);
+  if (delayed_release != 0) {
+    qukeys::Timestamp release_end = queue[delayed_release].time;
+    qukeys::Timestamp release_time =
+        (release_end - queue[0].time) +
+        releaseTimeout(queue[next_keypress].time, release_end,
+                       profile(qukey).overlapRequired());
+    if (elapsed >= release_time && release_time <= hold) {
+      key = qukey.primaryKey();
+      learnTap(qukey, release_end - queue[0].time);
+      return true;
+    }
+  }
+  if (elapsed >= hold) {
+    key = isSpaceCadet(qukey) ? qukey.primaryKey() : qukey.alternateKey();
+    return true;
+  }
+  return false;
+}
+
+// A tapped qukey with multi-tap keys (for at least two taps) starts a count.
+void ReferenceEngine::startMultiTap(byte qukey_index) {
+  if (qukeys::multi_tap_max < 2) {
+    return;
+  }
+  for (const qukeys::MultiTap& multi_tap : multi_taps_) {
+    if (multi_tap.qukeyIndex() == qukey_index) {
+      if (multi_tap.key(2) != cKey::clear) {
+        source_->multi_tap = &multi_tap;
+        source_->taps      = 1;
+      }
+      return;
+    }
+  }
+}
+
+Key ReferenceEngine::multiTapKey() const {
+  if (source_->taps == 1) {
+    return qukeys_[source_->multi_tap->qukeyIndex()].tapKey();
+  }
+  return source_->multi_tap->key(source_->taps);
+}
+
+bool ReferenceEngine::waitingForTapHold() {
+  std::vector<QueuedEvent>& queue = source_->queue;
+  if (!source_->release_delayed_for_tap_hold) {
+    return false;
+  }
+  qukeys::Timestamp now = host::scanTime();
+  qukeys::Timestamp timeout =
+      qukeys::Timestamp(profile(lookup(keymap_[queue[0].addr])).tapHoldTimeout()) *
+      qukeys::timestamp_ticks_per_ms;
+  while (source_->taps != 0 && queue.size() > 2 &&
+         queue[1].addr == queue[0].addr && !queue[1].release &&
+         queue[2].addr == queue[0].addr && queue[2].release &&
+         qukeys::Timestamp(queue[1].time - queue[0].time) <= timeout &&
+         qukeys::Timestamp(queue[2].time - queue[1].time) <= timeout) {
+    queue.erase(queue.begin(), queue.begin() + 2);
+    if (source_->multi_tap->key(++source_->taps + 1) == cKey::clear) {
+      return false;
+    }
+  }
+  if (queue.size() == 1) {
+    return qukeys::Timestamp(now - queue[0].time) <= timeout;
+  }
+  for (size_t i{1}; i < queue.size(); ++i) {
+    if (queue[i].addr != queue[0].addr) {
+      return false;
+    }
+  }
+  if (queue.size() == 2) {
+    if (qukeys::Timestamp(now - queue[1].time) > timeout) {
+      queue.clear();
+      source_->release_delayed_for_tap_hold = false;
+      return source_->taps == 0;
+    }
+    return true;
+  }
+  return false;
+}
+
+qukeys::Qukey ReferenceEngine::lookup(Key key) const {
+  byte index = qukeys::QukeysKey(key).data();
+  if (index < qukey_count_) {
+    return qukeys_[index];
+  }
+  return qukeys::Qukey{};
+}
+
+bool ReferenceEngine::usesGlobalProfile(const qukeys::Qukey& qukey) const {
+  return qukey.profile() == 0 || qukey.profile() > profile_count_;
+}
+
+qukeys::QukeyProfile ReferenceEngine::profile(const qukeys::Qukey& qukey) const {
+  if (usesGlobalProfile(qukey)) {
+    uint16_t hold = qukeys::adaptive_hold_timeout ? adaptive_timeout_ : qukeys::hold_timeout;
+    return {hold, qukeys::tap_hold_timeout, overlap_required_};
+  }
+  return profiles_[qukey.profile() - 1];
+}
+
+// The hold timeout, in ticks.
+qukeys::Timestamp ReferenceEngine::holdTimeout(const qukeys::Qukey& qukey) const {
+  return qukeys::Timestamp(profile(qukey).holdTimeout()) * qukeys::timestamp_ticks_per_ms;
+}
+
+// The adaptive hold timeout's percentile estimate, in 1/32ms: up by the percentile for
+// each tap (of `duration` ticks) longer than the estimate, down by the rest of 100 for
+// each shorter one.
+void ReferenceEngine::learnTap(const qukeys::Qukey& qukey, qukeys::Timestamp duration) {
+  if (!qukeys::adaptive_hold_timeout || !usesGlobalProfile(qukey)) {
+    return;
+  }
+  uint32_t milliseconds = duration / qukeys::timestamp_ticks_per_ms;
+  uint32_t sample = std::min<uint32_t>(milliseconds, qukeys::hold_timeout) * 32;
+  if (sample > tap_estimate_) {
+    tap_estimate_ += qukeys::adaptive_hold_percentile;
+  } else if (sample < tap_estimate_) {
+    int32_t lowered = int32_t(tap_estimate_) - (100 - qukeys::adaptive_hold_percentile);
+    tap_estimate_ = std::max<int32_t>(lowered, 0);
+  }
+  uint32_t timeout = tap_estimate_ / 32 + qukeys::adaptive_hold_margin;
+  timeout = std::max<uint32_t>(timeout, qukeys::adaptive_hold_timeout_min);
+  adaptive_timeout_ = std::min<uint32_t>(timeout, qukeys::hold_timeout);
+}
+
+void ReferenceEngine::send(KeyEvent event) {
+  ++flushed_;
+  event.caller = EventHandlerId::qukeys;
+  controller_.handleKeyEvent(event);
+}
+
+}  // namespace host
+}  // namespace kaleidoglyph
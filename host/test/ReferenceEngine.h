@@ -0,0 +1,129 @@
+// -*- c++ -*-
+
+// A deliberately simple, unoptimised model of Qukeys' resolution semantics, used as an
+// oracle for differential testing of `qukeys::Plugin`. It keeps the queue in a
+// `std::vector`, rescans it from the start on every pass, and searches it for matching
+// presses, exactly as the original engine did; it shares nothing with the production
+// engine but the `Qukey` definitions and the constants in `qukeys/constants.h`. It has
+// no deadline (so it expects `preKeyswitchScan()` in every scan cycle), and keeps no
+// state about a qukey between passes, so nothing it learns can go stale.
+//
+// It models the default semantics, plus `flush_unrelated_releases`, per-qukey timing
+// profiles, `adaptive_hold_timeout`, multi-tap qukeys, `bilateral_resolution`,
+// `timestamp_ticks_per_ms` (measuring everything in ticks, with the timeouts
+// converted from milliseconds, and the release delay
+// computed by division), `source_count` (with a separate queue for
+// each source, and the sources tried oldest first for each event that gets flushed), and
+// `concurrent_resolution` (for which it still only ever resolves the head of the queue,
+// from scratch, but measures the timeouts against event timestamps, which is what makes
+// resolving the others early unobservable). Options that are only
+// meant to make the engine faster (or to report on it) must not change its output, so
+// the model ignores them.
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <kaleidoglyph/Controller.h>
+#include <kaleidoglyph/KeyEvent.h>
+#include <kaleidoglyph/Keymap.h>
+
+#include "qukeys/Qukeys.h"
+
+namespace kaleidoglyph {
+namespace host {
+
+class ReferenceEngine {
+ public:
+  template <byte _qukey_count>
+  ReferenceEngine(const qukeys::QukeyTable<_qukey_count>& qukeys, Keymap& keymap,
+                  Controller& controller)
+      : qukeys_(qukeys.entries), qukey_count_(_qukey_count), keymap_(keymap),
+        controller_(controller) {}
+  template <byte _qukey_count, byte _profile_count>
+  ReferenceEngine(const qukeys::QukeyTable<_qukey_count>& qukeys,
+                  const qukeys::QukeyProfile (&profiles)[_profile_count], Keymap& keymap,
+                  Controller& controller)
+      : qukeys_(qukeys.entries), qukey_count_(_qukey_count), profiles_(profiles),
+        profile_count_(_profile_count), keymap_(keymap), controller_(controller) {}
+
+  void activate() { active_ = true; }
+  void deactivate() { active_ = false; }
+  void setMinimumOverlap(byte percentage) {
+    overlap_required_ = (percentage >= 100) ? 0 : percentage;
+  }
+  template <byte _count>
+  void setMultiTaps(const qukeys::MultiTapTable<_count>& multi_taps) {
+    multi_taps_.assign(multi_taps.entries, multi_taps.entries + _count);
+  }
+
+  EventHandlerResult onKeyswitchEvent(KeyEvent& event);
+  void preKeyswitchScan();
+
+ private:
+  struct QueuedEvent {
+    KeyAddr           addr;
+    bool              release;
+    qukeys::Timestamp time;
+  };
+
+  const qukeys::Qukey* qukeys_;
+  byte                 qukey_count_;
+  const qukeys::QukeyProfile* profiles_{nullptr};
+  byte                        profile_count_{0};
+  Keymap&              keymap_;
+  Controller&          controller_;
+
+  // Each source's queue and tap state, and the source being processed. Multi-tap
+  // qukeys: the taps counted so far (zero if there's no count going on), and the
+  // multi-tap entry of the qukey being tapped.
+  struct Source {
+    std::vector<QueuedEvent> queue;
+    bool                     release_delayed_for_tap_hold{false};
+    byte                     taps{0};
+    const qukeys::MultiTap*  multi_tap{nullptr};
+  };
+  std::vector<Source> sources_{qukeys::source_count};
+  Source*             source_{&sources_[0]};
+
+  byte overlap_required_{99};
+  bool active_{true};
+
+  std::vector<qukeys::MultiTap> multi_taps_;
+
+  // Events flushed in the scan cycle that started at `flush_time_`
+  qukeys::Timestamp flush_time_{0};
+  uint32_t          flushed_{0};
+
+  // Adaptive hold timeout state
+  uint32_t tap_estimate_{
+    uint32_t(std::max(int(qukeys::hold_timeout) - qukeys::adaptive_hold_margin, 0)) * 32};
+  uint16_t adaptive_timeout_{qukeys::hold_timeout};
+
+  std::vector<Source*> sourcesByAge();
+  void flush();
+  bool withinFlushBudget() const;
+  bool nextFlushEvent(KeyEvent& event);
+  bool releaseDelayed(qukeys::Timestamp overlap_start, qukeys::Timestamp overlap_end,
+                      byte overlap_required) const;
+  qukeys::Timestamp releaseTimeout(qukeys::Timestamp overlap_start,
+                                   qukeys::Timestamp overlap_end,
+                                   byte overlap_required) const;
+  bool timedOut(const qukeys::Qukey& qukey, size_t next_keypress, size_t delayed_release,
+                qukeys::Timestamp time, Key& key);
+  bool waitingForTapHold();
+  void startMultiTap(byte qukey_index);
+  Key multiTapKey() const;
+  qukeys::Qukey lookup(Key key) const;
+  bool usesGlobalProfile(const qukeys::Qukey& qukey) const;
+  qukeys::QukeyProfile profile(const qukeys::Qukey& qukey) const;
+  qukeys::Timestamp holdTimeout(const qukeys::Qukey& qukey) const;
+  void learnTap(const qukeys::Qukey& qukey, qukeys::Timestamp duration);
+  void send(KeyEvent event);
+};
+
+}  // namespace host
+}  // namespace kaleidoglyph
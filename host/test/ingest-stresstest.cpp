@@ -0,0 +1,169 @@
+// -*- c++ -*-
+
+// Stress test of the lock-free ingest ring (`qukeys/IngestRing.h`), with a producer
+// thread standing in for an interrupt handler, and a consumer thread standing in for the
+// scan loop. Both sides yield whenever they have to wait, so that the test also makes
+// progress on a single core.
+//
+// The first part pushes a long numbered sequence of records through a bare ring, as
+// fast as both sides can go, and requires every record to come out exactly once, in
+// order, and intact. The second part reports keystrokes through `Plugin::ingest()`
+// while the consumer runs scan cycles, and requires the events Qukeys passes on to be
+// the same keystrokes, in the same order. It must be built with a non-zero
+// `ingest_ring_size`.
+//
+// Usage: ingest-stresstest [records]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <kaleidoglyph/Controller.h>
+#include <kaleidoglyph/Keymap.h>
+
+#include "Harness.h"
+#include "qukeys/IngestRing.h"
+#include "qukeys/Qukeys.h"
+
+using namespace kaleidoglyph;
+
+static_assert(qukeys::ingest_ring_size != 0,
+              "ingest-stresstest must be built with a non-zero ingest_ring_size");
+
+namespace {
+
+typedef qukeys::IngestRing<qukeys::ingest_ring_size, qukeys::Timestamp> Ring;
+
+Ring::Record numberedRecord(uint32_t n) {
+  return {KeyAddr(n % total_keys), bool((n / total_keys) & 1), qukeys::Timestamp(n * 7)};
+}
+
+bool testRing(uint32_t count) {
+  Ring ring;
+  uint32_t full{0};
+
+  std::thread producer([&] {
+      for (uint32_t n{0}; n < count; ++n) {
+        while (!ring.push(numberedRecord(n))) {
+          ++full;
+          std::this_thread::yield();
+        }
+      }
+    });
+
+  uint32_t received{0};
+  uint32_t empty{0};
+  bool     ok{true};
+  while (received < count) {
+    Ring::Record record;
+    if (!ring.pop(record)) {
+      ++empty;
+      std::this_thread::yield();
+      continue;
+    }
+    Ring::Record expected = numberedRecord(received);
+    if (record.addr != expected.addr || record.press != expected.press ||
+        record.time != expected.time) {
+      printf("ring: record %u: got addr=%u press=%d time=%u\n", received,
+             record.addr.addr(), record.press, unsigned(record.time));
+      ok = false;
+      break;
+    }
+    ++received;
+  }
+  producer.join();
+
+  Ring::Record extra;
+  if (ok && ring.pop(extra)) {
+    printf("ring: extra record after %u\n", count);
+    ok = false;
+  }
+  printf("ring: %u records, %u full, %u empty: %s\n", count, full, empty,
+         ok ? "OK" : "FAILED");
+  return ok;
+}
+
+struct Output {
+  byte addr;
+  bool press;
+};
+
+void record(const KeyEvent& event, void* context) {
+  static_cast<std::vector<Output>*>(context)->push_back(
+      {event.addr.addr(), event.state.toggledOn()});
+}
+
+// Keystrokes of plain keys (not qukeys), which Qukeys passes on as soon as they're
+// queued, in order.
+bool testPlugin(uint32_t keystrokes) {
+  Keymap keymap;
+  host::setupKeymap(keymap);
+  std::vector<byte> addrs;
+  for (byte addr{0}; addr < total_keys; ++addr) {
+    if (!host::isQukeyAddr(addr)) {
+      addrs.push_back(addr);
+    }
+  }
+
+  Controller controller;
+  std::vector<Output> outputs;
+  controller.setSink(record, &outputs);
+  qukeys::Plugin plugin(host::test_qukeys, keymap, controller);
+
+  std::atomic<uint16_t> clock{0};
+  std::atomic<bool>     done{false};
+  std::thread producer([&] {
+      for (uint32_t n{0}; n < keystrokes; ++n) {
+        KeyAddr addr(addrs[n % addrs.size()]);
+        while (!plugin.ingest(addr, true, clock.load())) {
+          std::this_thread::yield();
+        }
+        while (!plugin.ingest(addr, false, clock.load())) {
+          std::this_thread::yield();
+        }
+      }
+      done = true;
+    });
+
+  uint32_t scans{0};
+  for (;;) {
+    bool finished = done.load();
+    Controller::setScanStartTime(++clock);
+    plugin.preKeyswitchScan();
+    ++scans;
+    std::this_thread::yield();
+    if (finished && outputs.size() == 2 * keystrokes) {
+      break;
+    }
+    if (finished && scans > 2 * keystrokes + 1000) {
+      break;
+    }
+  }
+  producer.join();
+
+  bool ok = (outputs.size() == 2 * keystrokes);
+  for (uint32_t i{0}; ok && i < outputs.size(); ++i) {
+    byte expected_addr = addrs[(i / 2) % addrs.size()];
+    if (outputs[i].addr != expected_addr || outputs[i].press != (i % 2 == 0)) {
+      printf("plugin: output %u: got addr=%u press=%d\n", i, outputs[i].addr,
+             outputs[i].press);
+      ok = false;
+    }
+  }
+  printf("plugin: %u keystrokes, %zu outputs in %u scans: %s\n", keystrokes,
+         outputs.size(), scans, ok ? "OK" : "FAILED");
+  return ok;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  uint32_t count = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 5000000;
+
+  bool ok = testRing(count);
+  ok = testPlugin(count / 10) && ok;
+  return ok ? 0 : 1;
+}
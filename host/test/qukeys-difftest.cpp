@@ -0,0 +1,391 @@
+// -*- c++ -*-
+
+// Randomized differential test of `qukeys::Plugin` against `ReferenceEngine`.
+//
+// Each iteration generates a keyswitch event sequence -- one of the benchmark scenarios
+// (typing, rollover, full-queue mashing, tap-hold), or a "chaos" sequence that hammers a
+// small set of qukeys and plain keys with random timing -- picks a random minimum
+// overlap, a random scan clock start (often just short of the 16-bit wraparound), a
+// random schedule of `activate()`/`deactivate()` calls, and whether or not to use the
+// per-qukey timing profiles, and whether to call `preKeyswitchScan()` only once Qukeys'
+// deadline has been reached, then runs it through both engines and requires the two
+// output streams to be identical: for each event, the key address, whether it's a press
+// or a release, the scan time it was sent in, and (for a press) its key. A release's
+// key isn't compared, because the next handler in the chain looks it up again anyway.
+// Each engine's controller applies the layer shifts it's sent to that engine's own copy
+// of the keymap, so a qukey that shifts layers changes what later keys look up.
+// With more than one `timestamp_ticks_per_ms`, both engines are run one scan cycle per
+// tick, and each event is reported in a random tick of its millisecond.
+//
+// Usage: qukeys-difftest [-n iterations] [-s seed] [-v]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <kaleidoglyph/Controller.h>
+#include <kaleidoglyph/Keymap.h>
+
+#include "Harness.h"
+#include "ReferenceEngine.h"
+#include "qukeys/Qukeys.h"
+
+using namespace kaleidoglyph;
+
+namespace {
+
+struct Output {
+  uint16_t time;
+  uint32_t ticks;
+  byte     addr;
+  bool     press;
+  uint16_t key;
+
+  bool operator==(const Output& other) const {
+    return time == other.time && ticks == other.ticks && addr == other.addr &&
+           press == other.press && key == other.key;
+  }
+};
+
+void record(const KeyEvent& event, void* context) {
+  bool press = event.state.toggledOn();
+  static_cast<std::vector<Output>*>(context)->push_back(
+      {Controller::scanStartTime(), Controller::scanStartTicks(), event.addr.addr(),
+       press, uint16_t(press ? event.key.raw() : 0)});
+}
+
+class Random {
+ public:
+  explicit Random(uint32_t seed) : state_(seed * 2654435761u + 1) {}
+  uint32_t next() {
+    state_ ^= state_ << 13;
+    state_ ^= state_ >> 17;
+    state_ ^= state_ << 5;
+    return state_;
+  }
+  uint32_t range(uint32_t lo, uint32_t hi) { return lo + next() % (hi - lo + 1); }
+  bool chance(uint32_t percent) { return (next() % 100) < percent; }
+
+ private:
+  uint32_t state_;
+};
+
+// Random toggling of a small pool of keys, with gaps chosen to land on both sides of
+// every timeout, and frequent same-scan and repeated presses of the same key.
+host::EventSequence chaos(Random& rng, uint32_t count, bool wide) {
+  static const byte narrow_pool[] = {17, 20, 23, 48, 56, 57, 0, 1, 2, 3};
+  static const byte wide_pool[] = {17, 18, 19, 20, 23, 24, 48, 56, 57,
+                                   0, 1, 2, 3, 4, 5, 6, 7};
+  const byte* pool = wide ? wide_pool : narrow_pool;
+  byte pool_size = wide ? sizeof(wide_pool) : sizeof(narrow_pool);
+
+  host::EventSequence events;
+  bool     down[total_keys] = {};
+  uint32_t last[total_keys] = {};
+  uint32_t t{0};
+  for (uint32_t n{0}; n < count; ++n) {
+    uint32_t roll = rng.range(0, 99);
+    if (roll < 20) {
+      // same scan cycle
+    } else if (roll < 70) {
+      t += rng.range(1, 30);
+    } else if (roll < 95) {
+      t += rng.range(30, 260);
+    } else {
+      t += rng.range(260, 600);
+    }
+    byte addr = pool[rng.range(0, pool_size - 1)];
+    if (t <= last[addr] && n > 0) {
+      continue;
+    }
+    down[addr] = !down[addr];
+    last[addr] = t;
+    events.push_back({t, addr, down[addr]});
+  }
+  for (byte addr{0}; addr < total_keys; ++addr) {
+    if (down[addr]) {
+      t = std::max(t, last[addr]) + 1;
+      events.push_back({t, addr, false});
+    }
+  }
+  return events;
+}
+
+// The tick of its millisecond in which each event is reported: random, but never
+// earlier than that of the event before it in the same millisecond. With one tick per
+// millisecond, they're all zero.
+std::vector<uint32_t> eventTicks(const host::EventSequence& events, uint32_t seed) {
+  std::vector<uint32_t> ticks(events.size(), 0);
+  if (qukeys::timestamp_ticks_per_ms == 1) {
+    return ticks;
+  }
+  Random rng(seed);
+  for (size_t i{0}; i < events.size(); ++i) {
+    ticks[i] = rng.range(0, qukeys::timestamp_ticks_per_ms - 1);
+    if (i > 0 && events[i].time == events[i - 1].time) {
+      ticks[i] = std::max(ticks[i], ticks[i - 1]);
+    }
+  }
+  return ticks;
+}
+
+// Whether a scan loop that only wakes Qukeys up when it has a deadline (see
+// `Plugin::nextDeadline()`) would call `preKeyswitchScan()` now. The reference model has
+// no deadline, so it always gets called.
+bool deadlineReached(const qukeys::Plugin& plugin) {
+  return plugin.hasDeadline() &&
+         qukeys::TimestampDifference(host::scanTime() - plugin.nextDeadline()) >= 0;
+}
+bool deadlineReached(const host::ReferenceEngine&) {
+  return true;
+}
+
+template <typename _Engine>
+std::vector<Output> run(_Engine& engine, Controller& controller,
+                        const host::EventSequence& events,
+                        const std::vector<uint32_t>& event_ticks, uint16_t start_time,
+                        const std::vector<uint32_t>& toggles, bool sleep = false) {
+  std::vector<Output> outputs;
+  controller.setSink(record, &outputs);
+
+  uint32_t end = (events.empty() ? 0 : events.back().time) + 1000;
+  size_t event{0};
+  auto toggle = toggles.begin();
+  bool active{true};
+  for (uint32_t t{0}; t <= end; ++t) {
+    for (uint32_t tick{0}; tick < qukeys::timestamp_ticks_per_ms; ++tick) {
+      host::setScanClock(start_time, t, tick);
+      for (; tick == 0 && toggle != toggles.end() && *toggle == t; ++toggle) {
+        active = !active;
+        if (active) {
+          engine.activate();
+        } else {
+          engine.deactivate();
+        }
+      }
+      if (!sleep || deadlineReached(engine)) {
+        engine.preKeyswitchScan();
+      }
+      for (; event < events.size() && events[event].time == t &&
+             event_ticks[event] == tick; ++event) {
+        KeyEvent key_event;
+        key_event.addr   = KeyAddr(events[event].addr);
+        key_event.state  = events[event].press ? cKeyState::press : cKeyState::release;
+        key_event.key    = cKey::clear;
+        key_event.caller = EventHandlerId::controller;
+        if (engine.onKeyswitchEvent(key_event) == EventHandlerResult::proceed) {
+          controller.handleKeyEvent(key_event);
+        }
+      }
+    }
+  }
+  return outputs;
+}
+
+void printOutput(const char* label, const std::vector<Output>& outputs, size_t index) {
+  if (index < outputs.size()) {
+    const Output& o = outputs[index];
+    printf("  %s: t=%u ticks=%u addr=%u %s key=0x%04x\n", label, o.time, o.ticks,
+           o.addr, o.press ? "press" : "release", o.key);
+  } else {
+    printf("  %s: (end of stream)\n", label);
+  }
+}
+
+// `ReleaseDelay` replaces a division with a multiplication; check that it gets exactly
+// the same result for every percentage and overlap (every one that fits in 16 bits, and
+// a sample of the longer ones, up to well past the saturation point, in ticks).
+bool checkReleaseDelay() {
+  const uint64_t max_timeout = 255 * qukeys::timestamp_ticks_per_ms;
+  const uint64_t max_overlap = std::max<uint64_t>(0xFFFF, max_timeout * 100);
+  for (uint16_t percentage{1}; percentage < 100; ++percentage) {
+    qukeys::ReleaseDelay release_delay(percentage);
+    for (uint64_t overlap{0}; overlap <= max_overlap;
+         overlap += (overlap < 0x10000) ? 1 : 7919) {
+      uint64_t limit = (overlap * 100) / percentage - overlap;
+      uint64_t expected = std::min(limit, max_timeout);
+      uint64_t actual = release_delay.timeout(overlap);
+      if (actual != expected) {
+        printf("ReleaseDelay(%u).timeout(%llu) = %llu, expected %llu\n", percentage,
+               (unsigned long long)overlap, (unsigned long long)actual,
+               (unsigned long long)expected);
+        return false;
+      }
+    }
+  }
+  return !qukeys::ReleaseDelay(0).enabled() && !qukeys::ReleaseDelay(100).enabled();
+}
+
+// A key that's held behind a qukey until the qukey times out and shifts layers has to
+// get its value from the layer it shifted to, whether or not its value was captured
+// when it was queued (see `capture_keys`). Both kinds of layer shift qukey are checked:
+// the SpaceCadet one, and the one with the layer shift as its alternate value.
+bool checkLayerShift(const Keymap& keymap) {
+  for (byte qukey_addr : {host::thumb_qukey_addr, host::layer_qukey_addr}) {
+    // The key is on the other hand from the qukey (so that `bilateral_resolution`
+    // doesn't make it resolve the qukey to its tap value), unless that's in a different
+    // source's queue (see `keySource()`), which the qukey couldn't hold it up in.
+    byte plain_addr = (qukeys::keySource(3) == qukeys::keySource(qukey_addr)) ? 3 : 9;
+    if (qukeys::bilateral_resolution &&
+        qukeys::keyZone(plain_addr) == qukeys::keyZone(qukey_addr)) {
+      continue;
+    }
+    const Key shifted_key = keyboardKey(0x1E + plain_addr);
+    const host::EventSequence events = {
+      {0, qukey_addr, true},
+      {10, plain_addr, true},
+    };
+    Keymap     layer_keymap = keymap;
+    Controller controller;
+    controller.setKeymap(&layer_keymap);
+    qukeys::Plugin plugin(host::test_qukeys, layer_keymap, controller);
+    std::vector<Output> outputs =
+        run(plugin, controller, events, std::vector<uint32_t>(events.size(), 0), 0, {});
+    auto press = std::find_if(outputs.begin(), outputs.end(), [&](const Output& o) {
+      return o.addr == plain_addr && o.press;
+    });
+    if (press == outputs.end() || press->key != shifted_key.raw()) {
+      printf("key %u held behind the layer shift qukey at %u: key=0x%04x, "
+             "expected 0x%04x\n", plain_addr, qukey_addr,
+             (press == outputs.end()) ? 0 : press->key, shifted_key.raw());
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  uint32_t iterations{3000};
+  uint32_t base_seed{1};
+  bool     verbose{false};
+  int opt;
+  while ((opt = getopt(argc, argv, "n:s:v")) != -1) {
+    switch (opt) {
+      case 'n':
+        iterations = strtoul(optarg, nullptr, 10);
+        break;
+      case 's':
+        base_seed = strtoul(optarg, nullptr, 0);
+        break;
+      case 'v':
+        verbose = true;
+        break;
+      default:
+        fprintf(stderr, "usage: qukeys-difftest [-n iterations] [-s seed] [-v]\n");
+        return 2;
+    }
+  }
+
+  static const byte overlaps[] = {0, 20, 50, 80, 99, 100};
+  static const char* const kinds[] = {
+    "typing", "rollover", "mashing", "tap-hold", "chaos", "wide-chaos",
+  };
+
+  if (!checkReleaseDelay()) {
+    return 1;
+  }
+
+  Keymap keymap;
+  host::setupKeymap(keymap);
+  if (!checkLayerShift(keymap)) {
+    return 1;
+  }
+
+  uint64_t total_events{0};
+  uint64_t total_outputs{0};
+  for (uint32_t n{0}; n < iterations; ++n) {
+    uint32_t seed = base_seed + n;
+    Random   rng(seed);
+
+    byte kind = rng.range(0, 5);
+    host::EventSequence events;
+    if (kind < 4) {
+      events = host::generate(host::Scenario(kind), rng.range(10, 200), rng.next());
+    } else {
+      events = chaos(rng, rng.range(20, 400), kind == 5);
+    }
+    uint16_t start_time = rng.chance(40) ? uint16_t(0 - rng.range(0, 3000))
+                                         : uint16_t(rng.next());
+    byte overlap = overlaps[rng.range(0, sizeof(overlaps) - 1)];
+    std::vector<uint32_t> toggles;
+    if (rng.chance(20) && !events.empty()) {
+      for (uint32_t t = rng.range(0, 500); t < events.back().time; t += rng.range(50, 800)) {
+        toggles.push_back(t);
+      }
+    }
+
+    bool profiled = rng.chance(50);
+    bool sleep = rng.chance(50);
+    std::vector<uint32_t> event_ticks = eventTicks(events, seed);
+
+    // Each engine gets its own copy of the keymap, which its controller applies the
+    // layer shifts it flushes to.
+    Keymap     production_keymap = keymap;
+    Controller production_controller;
+    production_controller.setKeymap(&production_keymap);
+    qukeys::Plugin production =
+        profiled ? qukeys::Plugin(host::profiled_qukeys, host::test_profiles,
+                                  production_keymap, production_controller)
+                 : qukeys::Plugin(host::test_qukeys, production_keymap,
+                                  production_controller);
+    production.setMinimumOverlap(overlap);
+    host::useMultiTaps(production);
+    std::vector<Output> actual =
+        run(production, production_controller, events, event_ticks, start_time, toggles,
+            sleep);
+
+    Keymap     reference_keymap = keymap;
+    Controller reference_controller;
+    reference_controller.setKeymap(&reference_keymap);
+    host::ReferenceEngine reference =
+        profiled ? host::ReferenceEngine(host::profiled_qukeys, host::test_profiles,
+                                         reference_keymap, reference_controller)
+                 : host::ReferenceEngine(host::test_qukeys, reference_keymap,
+                                         reference_controller);
+    reference.setMinimumOverlap(overlap);
+    host::useMultiTaps(reference);
+    std::vector<Output> expected =
+        run(reference, reference_controller, events, event_ticks, start_time, toggles);
+
+    total_events  += events.size();
+    total_outputs += expected.size();
+    if (verbose) {
+      printf("seed %u: %s, %zu events, start %u, overlap %u, %zu toggles%s\n", seed,
+             kinds[kind], events.size(), start_time, overlap, toggles.size(),
+             profiled ? ", profiled" : "");
+    }
+    if (actual == expected) {
+      continue;
+    }
+
+    size_t i{0};
+    while (i < actual.size() && i < expected.size() && actual[i] == expected[i]) {
+      ++i;
+    }
+    printf("MISMATCH (seed %u: %s, %zu events, start %u, overlap %u, %zu toggles%s)\n",
+           seed, kinds[kind], events.size(), start_time, overlap, toggles.size(),
+           profiled ? ", profiled" : "");
+    printf("first difference at output %zu:\n", i);
+    printOutput("expected", expected, i);
+    printOutput("actual  ", actual, i);
+    printf("input events up to that point:\n");
+    uint32_t limit = (i < expected.size()) ? uint16_t(expected[i].time - start_time) : ~0u;
+    for (const host::TimedEvent& event : events) {
+      if (event.time > limit) {
+        break;
+      }
+      printf("  t=%u addr=%u %s\n", uint16_t(start_time + event.time), event.addr,
+             event.press ? "press" : "release");
+    }
+    return 1;
+  }
+
+  printf("qukeys-difftest: %u sequences, %llu events, %llu outputs: OK\n", iterations,
+         (unsigned long long)total_events, (unsigned long long)total_outputs);
+  return 0;
+}
@@ -0,0 +1,138 @@
+// -*- c++ -*-
+
+// Replay an input trace through `qukeys::Plugin` as fast as possible, and (optionally)
+// write the resolved event stream as an output trace.
+//
+// The trace is streamed from a memory mapping. The replay runs one scan cycle every
+// `scan-period` microseconds of simulated time (default 1000, i.e. a 1kHz scan rate):
+// each cycle calls `preKeyswitchScan()`, then delivers every trace event whose
+// timestamp has been reached. After the last event, it keeps scanning for another
+// second of simulated time so that all pending timeouts expire.
+//
+// Usage: qukeys-replay [-p scan-period-us] [-m minimum-overlap] [-o resolved-trace] trace
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include <kaleidoglyph/Controller.h>
+#include <kaleidoglyph/Keymap.h>
+
+#include "Harness.h"
+#include "Trace.h"
+#include "qukeys/Qukeys.h"
+
+using namespace kaleidoglyph;
+
+namespace {
+
+void writeResolved(const KeyEvent& event, void* context) {
+  static_cast<host::TraceWriter*>(context)->writeOutput(Controller::scanStartTime(), event);
+}
+
+int usage() {
+  fprintf(stderr, "usage: qukeys-replay [-p scan-period-us] [-m minimum-overlap] "
+          "[-o resolved-trace] trace\n");
+  return 2;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  uint32_t    scan_period_us{1000};
+  int         minimum_overlap{-1};
+  const char* output_path{nullptr};
+
+  int opt;
+  while ((opt = getopt(argc, argv, "p:m:o:")) != -1) {
+    switch (opt) {
+      case 'p':
+        scan_period_us = strtoul(optarg, nullptr, 10);
+        break;
+      case 'm':
+        minimum_overlap = atoi(optarg);
+        break;
+      case 'o':
+        output_path = optarg;
+        break;
+      default:
+        return usage();
+    }
+  }
+  if (optind + 1 != argc || scan_period_us == 0) {
+    return usage();
+  }
+
+  host::TraceReader reader;
+  if (!reader.open(argv[optind])) {
+    return 1;
+  }
+
+  Keymap keymap;
+  host::setupKeymap(keymap);
+  Controller controller;
+  qukeys::Plugin plugin(host::test_qukeys, keymap, controller);
+  if (minimum_overlap >= 0) {
+    plugin.setMinimumOverlap(minimum_overlap);
+  }
+
+  host::TraceWriter writer;
+  if (output_path != nullptr) {
+    if (!writer.open(output_path, host::trace_output_magic)) {
+      return 1;
+    }
+    controller.setSink(writeResolved, &writer);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  host::TraceEvent event;
+  bool     have_event = reader.next(event);
+  uint64_t first_ms   = have_event ? event.time : 0;
+  uint64_t now_us     = first_ms * 1000;
+  uint64_t end_ms     = 0;
+  uint64_t scans{0};
+  uint64_t events{0};
+  for (;;) {
+    uint64_t now_ms = now_us / 1000;
+    if (!have_event && now_ms > end_ms) {
+      break;
+    }
+    host::setScanClock(0, now_ms, (now_us % 1000) * qukeys::timestamp_ticks_per_ms / 1000);
+    plugin.preKeyswitchScan();
+    while (have_event && event.time <= now_ms) {
+      KeyEvent key_event;
+      key_event.addr   = KeyAddr(event.addr);
+      key_event.state  = event.press ? cKeyState::press : cKeyState::release;
+      key_event.key    = cKey::clear;
+      key_event.caller = EventHandlerId::controller;
+      if (plugin.onKeyswitchEvent(key_event) == EventHandlerResult::proceed) {
+        controller.handleKeyEvent(key_event);
+      }
+      ++events;
+      have_event = reader.next(event);
+      if (!have_event) {
+        end_ms = now_ms + 1000;
+      }
+    }
+    now_us += scan_period_us;
+    ++scans;
+  }
+
+  auto stop = std::chrono::steady_clock::now();
+  if (output_path != nullptr && !writer.close()) {
+    fprintf(stderr, "%s: write failed\n", output_path);
+    return 1;
+  }
+
+  double seconds   = std::chrono::duration<double>(stop - start).count();
+  double simulated = (now_us / 1000 - first_ms) / 1000.0;
+  printf("events in:  %llu\n", (unsigned long long)events);
+  printf("events out: %u (checksum %08x)\n", controller.eventCount(), controller.checksum());
+  printf("scans:      %llu (%u us period)\n", (unsigned long long)scans, scan_period_us);
+  printf("replayed %.1f s of typing in %.3f s: %.2f M events/s, %.0fx real time\n",
+         simulated, seconds, events / seconds / 1e6, simulated / seconds);
+  return 0;
+}
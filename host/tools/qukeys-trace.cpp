@@ -0,0 +1,73 @@
+// -*- c++ -*-
+
+// Write generated keyswitch event sequences as input traces, or dump a trace as text.
+//
+// Usage: qukeys-trace generate <scenario> <keystrokes> <seed> <trace> [start-time]
+//        qukeys-trace dump <trace>
+//
+// Scenarios are the ones the benchmark uses: typing, rollover, mashing, tap-hold.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Harness.h"
+#include "Trace.h"
+
+using namespace kaleidoglyph;
+
+namespace {
+
+int usage() {
+  fprintf(stderr,
+          "usage: qukeys-trace generate <scenario> <keystrokes> <seed> <trace> "
+          "[start-time]\n"
+          "       qukeys-trace dump <trace>\n");
+  return 2;
+}
+
+bool parseScenario(const char* name, host::Scenario& scenario) {
+  for (byte s{0}; s <= byte(host::Scenario::tap_hold); ++s) {
+    if (strcmp(name, host::scenarioName(host::Scenario(s))) == 0) {
+      scenario = host::Scenario(s);
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc >= 6 && strcmp(argv[1], "generate") == 0) {
+    host::Scenario scenario;
+    if (!parseScenario(argv[2], scenario)) {
+      fprintf(stderr, "unknown scenario: %s\n", argv[2]);
+      return 2;
+    }
+    uint32_t keystrokes = strtoul(argv[3], nullptr, 10);
+    uint32_t seed       = strtoul(argv[4], nullptr, 0);
+    uint16_t start_time = (argc > 6) ? strtoul(argv[6], nullptr, 0) : 0;
+    host::EventSequence events = host::generate(scenario, keystrokes, seed);
+    if (!host::writeSequence(argv[5], events, start_time)) {
+      return 1;
+    }
+    printf("%s: %zu events\n", argv[5], events.size());
+    return 0;
+  }
+
+  if (argc == 3 && strcmp(argv[1], "dump") == 0) {
+    host::TraceReader reader;
+    if (!reader.open(argv[2])) {
+      return 1;
+    }
+    host::TraceEvent event;
+    while (reader.next(event)) {
+      printf("%llu %u %s\n", (unsigned long long)event.time, unsigned(event.addr),
+             event.press ? "press" : "release");
+    }
+    return 0;
+  }
+
+  return usage();
+}
@@ -0,0 +1,93 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace kaleidoglyph {
+namespace qukeys {
+
+// A streaming estimate of the `_percentile`th percentile of the press-to-release times
+// of qukeys that were tapped, used to set the hold timeout to that estimate plus
+// `_margin` milliseconds, within [`_min_timeout`, `_max_timeout`].
+//
+// The estimate is kept in units of 1/32ms, and each new tap duration nudges it: up by
+// `_percentile` units if the tap was longer, or down by `100 - _percentile` units if it
+// was shorter. It settles where those steps balance, which is where `_percentile`% of
+// taps are shorter. That takes two bytes of RAM, and no division (or floating point). A
+// tap can't be observed if it takes longer than the hold timeout in effect at the time,
+// so the estimate starts out giving a timeout of `_max_timeout`, and works down from
+// there.
+template <bool     _enabled,
+          uint16_t _min_timeout,
+          uint16_t _max_timeout,
+          byte     _percentile,
+          byte     _margin>
+class AdaptiveHoldTimeout {
+  static_assert(_percentile > 0 && _percentile < 100,
+                "The adaptive hold timeout percentile must be between 1 and 99");
+  static_assert(_min_timeout <= _max_timeout,
+                "The adaptive hold timeout minimum is longer than hold_timeout");
+
+  static constexpr byte     fraction_bits{5};
+  // The estimate only goes up while it's below a sample, so it can get to just short of
+  // `_percentile` units past the longest one.
+  static_assert((uint32_t(_max_timeout) << fraction_bits) + _percentile <= 0xFFFF,
+                "hold_timeout too long for the adaptive estimate");
+  static constexpr uint16_t initial_estimate{
+    (_max_timeout > _margin ? _max_timeout - _margin : 0) << fraction_bits};
+
+ public:
+  void recordTap(uint16_t duration) {
+    if (duration > _max_timeout) {
+      duration = _max_timeout;
+    }
+    uint16_t sample = duration << fraction_bits;
+    if (sample > estimate_) {
+      estimate_ += _percentile;
+    } else if (sample < estimate_) {
+      constexpr byte step = 100 - _percentile;
+      estimate_ = (estimate_ > step) ? estimate_ - step : 0;
+    } else {
+      return;
+    }
+    uint16_t timeout = (estimate_ >> fraction_bits) + _margin;
+    timeout_ = (timeout < _min_timeout) ? _min_timeout
+             : (timeout > _max_timeout) ? _max_timeout
+             : timeout;
+  }
+
+  // The current estimate of the tap duration percentile, in milliseconds
+  uint16_t estimate() const {
+    return estimate_ >> fraction_bits;
+  }
+  // The hold timeout in effect
+  uint16_t timeout() const {
+    return timeout_;
+  }
+
+  void reset() {
+    estimate_ = initial_estimate;
+    timeout_  = _max_timeout;
+  }
+
+ private:
+  uint16_t estimate_{initial_estimate};
+  uint16_t timeout_{_max_timeout};
+};
+
+// With the adaptive timeout turned off, the hold timeout is always `_max_timeout`, and
+// this takes up no RAM at all.
+template <uint16_t _min_timeout, uint16_t _max_timeout, byte _percentile, byte _margin>
+class AdaptiveHoldTimeout<false, _min_timeout, _max_timeout, _percentile, _margin> {
+ public:
+  void recordTap(uint16_t) {}
+
+  uint16_t estimate() const { return 0; }
+  uint16_t timeout() const { return _max_timeout; }
+
+  void reset() {}
+};
+
+} // namespace qukeys {
+} // namespace kaleidoglyph {
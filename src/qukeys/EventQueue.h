@@ -5,6 +5,7 @@
 #include <Arduino.h>
 
 #include <kaleidoglyph/Controller.h>
+#include <kaleidoglyph/Key.h>
 #include <kaleidoglyph/KeyAddr.h>
 #include <kaleidoglyph/KeyEvent.h>
 #include <kaleidoglyph/KeyState.h>
@@ -13,71 +14,379 @@
 
 namespace kaleidoglyph {
 
+// The smallest unsigned type with at least `_max_length` bits, for the queue's
+// per-entry bitfields; queues of up to 64 events are supported.
 template <byte _max_length,
-          typename _Bitfield  = byte,
-          typename _Timestamp = uint16_t>
-class EventQueue {
+          bool _fits_byte   = (_max_length <= 8),
+          bool _fits_16bits = (_max_length <= 16),
+          bool _fits_32bits = (_max_length <= 32)>
+struct EventQueueBitfield {
+  static_assert(_max_length <= 64, "EventQueue can't hold more than 64 events");
+  typedef uint64_t type;
+};
+template <byte _max_length, bool _fits_16bits, bool _fits_32bits>
+struct EventQueueBitfield<_max_length, true, _fits_16bits, _fits_32bits> {
+  typedef byte type;
+};
+template <byte _max_length, bool _fits_32bits>
+struct EventQueueBitfield<_max_length, false, true, _fits_32bits> {
+  typedef uint16_t type;
+};
+template <byte _max_length>
+struct EventQueueBitfield<_max_length, false, false, true> {
+  typedef uint32_t type;
+};
+
+// The index of the first event in the queue's storage arrays. In the (default) linear
+// layout, the head is always at index 0, and this costs no RAM; in the circular layout,
+// it moves forward each time an event is shifted off the queue.
+template <bool _circular>
+struct EventQueueHead {
+  byte head_{0};
+  void setHead(byte head) { head_ = head; }
+};
+template <>
+struct EventQueueHead<false> {
+  static constexpr byte head_{0};
+  void setHead(byte) {}
+};
+
+// Timestamp storage. By default, every queued event has its own full timestamp. In the
+// compact layout, only the head event's timestamp is stored in full; each of the others
+// stores the time since the event before it in a single byte, saturating at 255 (ms, or
+// ticks). A timestamp after a saturated gap reads as earlier than it really was, so the
+// compact layout is only exact if consecutive events in the queue are never more than
+// 255 apart (Qukeys guarantees that as long as `hold_timeout` is at most 256).
+template <byte _max_length, typename _Timestamp, bool _compact>
+struct EventQueueTimestamps {
+  _Timestamp timestamps_[_max_length];
+};
+template <byte _max_length, typename _Timestamp>
+struct EventQueueTimestamps<_max_length, _Timestamp, true> {
+  _Timestamp base_timestamp_;
+  byte       timestamp_gaps_[_max_length];
+};
+
+// Key storage. Optionally, each queued event also keeps the `Key` value it had when it
+// was appended (for a press, normally its keymap value), so that it doesn't have to be
+// looked up again, at the cost of two bytes per entry.
+template <byte _max_length, bool _keys>
+struct EventQueueKeys {
+  Key keys_[_max_length];
+  void storeKey(byte slot, Key key) { keys_[slot] = key; }
+  void moveKey(byte from, byte to) { keys_[to] = keys_[from]; }
+  Key  storedKey(byte slot) const { return keys_[slot]; }
+};
+template <byte _max_length>
+struct EventQueueKeys<_max_length, false> {
+  void storeKey(byte, Key) {}
+  void moveKey(byte, byte) {}
+  Key  storedKey(byte) const { return Key(0); }
+};
+
+// A queue of keyswitch events. With `_circular == false`, the events are stored in
+// order starting at index 0, so `shift()` and `remove()` have to move every later event
+// down one slot. With `_circular == true`, the storage is a ring buffer, and the release
+// bits are indexed by storage slot rather than by queue position (i.e. the bitfield is
+// "rotated" by `head_`), so `shift()` is O(1), and `remove()` only moves the events on
+// the shorter side of the removed one. The public interface is the same either way.
+//
+// The queue also pairs up the press and release events of each key while both are in
+// the queue, so that the question "is the press of the key released at `index` still in
+// the queue?" is a single bit test, rather than a search. To do that, it keeps a bitmap,
+// indexed by `KeyAddr`, of keys that have a press in the queue that hasn't been
+// released yet (`total_keys` bits: 8 bytes on a 64-key board), plus one bit per queue
+// entry. The cost is moved to the (much rarer) points where a pair is formed or broken:
+// appending the release of a queued press, and removing one half of a pair; each of
+// those searches the queue for the other half.
+//
+// With `_compact_timestamps == true`, the timestamps take `_max_length + 2` bytes
+// instead of `2 * _max_length` (see `EventQueueTimestamps`); reading the timestamp of
+// the event at `index` then costs `index` additions, and `shift()` rebases the queue on
+// the next event's timestamp.
+//
+// With `_keys == true`, `key()` returns the `Key` value each event had when it was
+// appended (see `EventQueueKeys`); otherwise, it's always zero.
+//
+// The per-entry bitfields are `_Bitfield`, which defaults to the smallest type that's
+// wide enough for `_max_length` (see `EventQueueBitfield`). The bits are set and cleared
+// with masks of that type, so a `uint64_t` bitfield works even where the Arduino bit
+// macros only shift an `unsigned long`.
+template <byte _max_length,
+          typename _Bitfield  = typename EventQueueBitfield<_max_length>::type,
+          typename _Timestamp = uint16_t,
+          bool     _circular  = false,
+          bool     _compact_timestamps = false,
+          bool     _keys      = false>
+class EventQueue
+    : private EventQueueHead<_circular>,
+      private EventQueueTimestamps<_max_length, _Timestamp, _compact_timestamps>,
+      private EventQueueKeys<_max_length, _keys> {
   static_assert(_max_length <= (sizeof(_Bitfield) * 8),
                 "_Bitfield type too small for _max_length!");
+  using EventQueueHead<_circular>::head_;
+  using EventQueueHead<_circular>::setHead;
+  using EventQueueKeys<_max_length, _keys>::storeKey;
+  using EventQueueKeys<_max_length, _keys>::moveKey;
+  using EventQueueKeys<_max_length, _keys>::storedKey;
+  // Tag type used to select the timestamp layout's versions of the private helpers
+  // below; only the selected ones are ever instantiated.
+  template <bool> struct Compact {};
+  using TimestampLayout = Compact<_compact_timestamps>;
  public:
   byte length() const { return length_; }
   bool isEmpty() const { return (length_ == 0); }
   bool isFull() const { return (length_ == _max_length); }
 
+  // Add an event to the end of the queue, with the current scan time as its timestamp,
+  // or with an earlier one (no earlier than that of the event before it).
   void append(KeyEvent event) {
-    addrs_[length_]      = event.addr;
-    timestamps_[length_] = Controller::scanStartTime();
-    bitWrite(release_event_bits_, length_, event.state.toggledOff());
+    append(event, Controller::scanStartTime());
+  }
+  void append(KeyEvent event, _Timestamp time) {
+    byte tail = slot(length_);
+    bool is_release = event.state.toggledOff();
+    addrs_[tail] = event.addr;
+    storeKey(tail, event.key);
+    appendTimestamp(tail, time, TimestampLayout{});
+    writeBit(release_event_bits_, tail, is_release);
+    clearBit(paired_event_bits_, tail);
+    if (!is_release) {
+      setPressPending(event.addr, true);
+    } else if (isPressPending(event.addr)) {
+      // The most recent event in the queue from the same key is its press.
+      setPressPending(event.addr, false);
+      for (byte i{length_}; i-- > 0; ) {
+        if (addrs_[slot(i)] == event.addr) {
+          setBit(paired_event_bits_, slot(i));
+          break;
+        }
+      }
+      setBit(paired_event_bits_, tail);
+    }
     ++length_;
   }
   void remove(byte index) {
+    unpair(index);
+    removeTimestamp(index, TimestampLayout{});
+    if (_circular && index < (length_ / 2)) {
+      // Closer to the head: move the preceding events up one slot, then advance the
+      // head past the vacated slot.
+      for (byte i{index}; i > 0; --i) {
+        moveSlot(slot(i - 1), slot(i));
+      }
+      setHead(slot(1));
+      --length_;
+      return;
+    }
     --length_;
+    if (_circular) {
+      for (byte i{index}; i < length_; ++i) {
+        moveSlot(slot(i + 1), slot(i));
+      }
+      return;
+    }
     for (byte i{index}; i < length_; ++i) {
-      addrs_[i]      = addrs_[i + 1];
-      timestamps_[i] = timestamps_[i + 1];
+      addrs_[i] = addrs_[i + 1];
+      moveKey(i + 1, i);
+      moveTimestamp(i + 1, i, TimestampLayout{});
     }
-    static constexpr _Bitfield all = -1;
-    _Bitfield tail_mask = all << index;
-    _Bitfield head_mask = ~tail_mask;
-    _Bitfield tail = (release_event_bits_ >> 1) & tail_mask;
-    _Bitfield head = release_event_bits_ & head_mask;
-    release_event_bits_ = tail | head;
+    removeBit(release_event_bits_, index);
+    removeBit(paired_event_bits_, index);
   }
   void shift() {
+    unpair(0);
+    removeTimestamp(0, TimestampLayout{});
     --length_;
+    if (_circular) {
+      setHead(slot(1));
+      return;
+    }
     for (byte i{0}; i < length_; ++i) {
-      addrs_[i]      = addrs_[i + 1];
-      timestamps_[i] = timestamps_[i + 1];
+      addrs_[i] = addrs_[i + 1];
+      moveKey(i + 1, i);
+      moveTimestamp(i + 1, i, TimestampLayout{});
     }
     release_event_bits_ >>= 1;
+    paired_event_bits_ >>= 1;
   }
   void clear() {
     length_ = 0;
     release_event_bits_ = 0;
+    paired_event_bits_ = 0;
+    for (byte& bits : pending_press_bits_) {
+      bits = 0;
+    }
   }
 
-  KeyAddr addr(byte index) const { return addrs_[index]; }
+  KeyAddr addr(byte index) const { return addrs_[slot(index)]; }
 
-  _Timestamp timestamp(byte index) const { return timestamps_[index]; }
+  Key key(byte index) const { return storedKey(slot(index)); }
+  void setKey(byte index, Key key) { storeKey(slot(index), key); }
+
+  _Timestamp timestamp(byte index) const {
+    return timestamp(index, TimestampLayout{});
+  }
 
   bool isRelease(byte index) const {
-    return bitRead(release_event_bits_, index);
+    return bitRead(release_event_bits_, slot(index));
   }
   bool isPress(byte index) const { return !isRelease(index); }
 
+  // Returns true if the other half of the event at `index` (the press of a release, or
+  // the release of a press) is also in the queue.
+  bool isPaired(byte index) const {
+    return bitRead(paired_event_bits_, slot(index));
+  }
+
+  // Returns true if there's a press of the key at `k` in the queue, and its release
+  // isn't in the queue (yet).
+  bool isPressPending(KeyAddr k) const {
+    return bitRead(pending_press_bits_[k.addr() / 8], k.addr() % 8);
+  }
+
   KeyEvent head() const {
     KeyEvent event;
-    event.addr = addrs_[0];
+    event.addr = addrs_[head_];
     event.state =
-        bitRead(release_event_bits_, 0) ? cKeyState::release : cKeyState::press;
+        bitRead(release_event_bits_, head_) ? cKeyState::release : cKeyState::press;
     return event;
   }
 
  private:
   byte       length_{0};
   KeyAddr    addrs_[_max_length];
-  _Timestamp timestamps_[_max_length];
   _Bitfield  release_event_bits_;
+  _Bitfield  paired_event_bits_;
+  byte       pending_press_bits_[(total_keys + 7) / 8] = {};
+
+  // Translate a queue position to a storage slot.
+  byte slot(byte index) const {
+    byte s = head_ + index;
+    if ((_max_length & (_max_length - 1)) == 0) {
+      return s & (_max_length - 1);
+    }
+    return (s < _max_length) ? s : s - _max_length;
+  }
+
+  void moveSlot(byte from, byte to) {
+    addrs_[to] = addrs_[from];
+    moveKey(from, to);
+    moveTimestamp(from, to, TimestampLayout{});
+    writeBit(release_event_bits_, to, bitRead(release_event_bits_, from));
+    writeBit(paired_event_bits_, to, bitRead(paired_event_bits_, from));
+  }
+
+  // Bitfield updates, with masks as wide as `_Bitfield`
+  static void setBit(_Bitfield& bits, byte index) {
+    bits |= _Bitfield(1) << index;
+  }
+  static void clearBit(_Bitfield& bits, byte index) {
+    bits &= ~(_Bitfield(1) << index);
+  }
+  static void writeBit(_Bitfield& bits, byte index, bool value) {
+    if (value) {
+      setBit(bits, index);
+    } else {
+      clearBit(bits, index);
+    }
+  }
+
+  // Full timestamps: one per storage slot.
+  void appendTimestamp(byte tail, _Timestamp time, Compact<false>) {
+    this->timestamps_[tail] = time;
+  }
+  _Timestamp timestamp(byte index, Compact<false>) const {
+    return this->timestamps_[slot(index)];
+  }
+  void moveTimestamp(byte from, byte to, Compact<false>) {
+    this->timestamps_[to] = this->timestamps_[from];
+  }
+  void removeTimestamp(byte, Compact<false>) {}
+
+  // Compact timestamps: the head's timestamp, plus the gap before each later event.
+  void appendTimestamp(byte tail, _Timestamp time, Compact<true>) {
+    if (length_ == 0) {
+      this->base_timestamp_ = time;
+      return;
+    }
+    _Timestamp gap = time - timestamp(length_ - 1, Compact<true>{});
+    this->timestamp_gaps_[tail] = (gap < 255) ? gap : 255;
+  }
+  _Timestamp timestamp(byte index, Compact<true>) const {
+    _Timestamp t = this->base_timestamp_;
+    for (byte i{1}; i <= index; ++i) {
+      t += this->timestamp_gaps_[slot(i)];
+    }
+    return t;
+  }
+  void moveTimestamp(byte from, byte to, Compact<true>) {
+    this->timestamp_gaps_[to] = this->timestamp_gaps_[from];
+  }
+  // Called before the event at `index` leaves the queue: if it's the head, rebase the
+  // queue on the next event's timestamp; otherwise, fold its gap into the next event's.
+  void removeTimestamp(byte index, Compact<true>) {
+    if (index + 1 >= length_) {
+      return;
+    }
+    byte next = slot(index + 1);
+    if (index == 0) {
+      this->base_timestamp_ += this->timestamp_gaps_[next];
+      return;
+    }
+    uint16_t gap = this->timestamp_gaps_[next] + this->timestamp_gaps_[slot(index)];
+    this->timestamp_gaps_[next] = (gap < 255) ? gap : 255;
+  }
+
+  // Remove bit `index` from a linear-layout bitfield, moving the higher bits down.
+  static void removeBit(_Bitfield& bits, byte index) {
+    static constexpr _Bitfield all = -1;
+    _Bitfield tail_mask = all << index;
+    _Bitfield head_mask = ~tail_mask;
+    _Bitfield tail = (bits >> 1) & tail_mask;
+    _Bitfield head = bits & head_mask;
+    bits = tail | head;
+  }
+
+  void setPressPending(KeyAddr k, bool pending) {
+    byte mask = 1 << (k.addr() % 8);
+    if (pending) {
+      pending_press_bits_[k.addr() / 8] |= mask;
+    } else {
+      pending_press_bits_[k.addr() / 8] &= ~mask;
+    }
+  }
+
+  // Called before the event at `index` leaves the queue. An unpaired press is its key's
+  // pending press; a paired event's partner gets unpaired, and if that partner is a
+  // press, the key has a pending press again.
+  void unpair(byte index) {
+    byte    s = slot(index);
+    KeyAddr k = addrs_[s];
+    bool    is_release = bitRead(release_event_bits_, s);
+    if (!bitRead(paired_event_bits_, s)) {
+      if (!is_release) {
+        setPressPending(k, false);
+      }
+      return;
+    }
+    if (is_release) {
+      for (byte i{index}; i-- > 0; ) {
+        if (addrs_[slot(i)] == k) {
+          clearBit(paired_event_bits_, slot(i));
+          break;
+        }
+      }
+      setPressPending(k, true);
+    } else {
+      for (byte i = index + 1; i < length_; ++i) {
+        if (addrs_[slot(i)] == k) {
+          clearBit(paired_event_bits_, slot(i));
+          break;
+        }
+      }
+    }
+  }
 };
 
 }  // namespace kaleidoglyph
@@ -0,0 +1,70 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+
+namespace kaleidoglyph {
+namespace qukeys {
+
+// The count of events flushed from the queue in the current scan cycle, against a budget
+// of `_budget` of them (see `flush_budget`), and whether any had to be carried over to a
+// later one. A scan cycle is identified by its start time (a `_Timestamp`, the same type
+// as the queue's timestamps). A budget of zero means no limit, and gets the empty
+// version below, which (because `Plugin` inherits from it) costs nothing.
+template <byte _budget, typename _Timestamp = uint16_t>
+class FlushBudget {
+ public:
+  // Start the count over, for the scan cycle that started at `time`
+  void restartFlushBudget(_Timestamp time) {
+    time_     = time;
+    flushed_  = 0;
+    deferred_ = false;
+  }
+  // Start the count over if `time` isn't the start of the scan cycle it's counting
+  void updateFlushBudget(_Timestamp time) {
+    if (time != time_) {
+      restartFlushBudget(time);
+    }
+  }
+
+  bool flushBudgetLeft() const {
+    return flushed_ < _budget;
+  }
+  void countFlushed() {
+    if (flushed_ < _budget) {
+      ++flushed_;
+    }
+  }
+
+  // Record that flushing has to be carried over to a later scan cycle. Returns true only
+  // the first time in each one.
+  bool deferFlushing() {
+    if (deferred_) {
+      return false;
+    }
+    deferred_ = true;
+    return true;
+  }
+
+ private:
+  _Timestamp time_{0};
+  byte       flushed_{0};
+  bool       deferred_{false};
+};
+
+template <typename _Timestamp>
+class FlushBudget<0, _Timestamp> {
+ public:
+  void restartFlushBudget(_Timestamp) {}
+  void updateFlushBudget(_Timestamp) {}
+
+  bool flushBudgetLeft() const { return true; }
+  void countFlushed() {}
+
+  bool deferFlushing() { return false; }
+};
+
+} // namespace qukeys {
+} // namespace kaleidoglyph {
@@ -0,0 +1,81 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/KeyAddr.h>
+
+
+namespace kaleidoglyph {
+namespace qukeys {
+
+// A raw keyswitch event, as an interrupt handler (or a DMA completion handler) reports
+// it: the key's address, whether it was pressed or released, and when (as a
+// `_Timestamp`, the same type as the queue's timestamps).
+template <typename _Timestamp = uint16_t>
+struct IngestRecord {
+  KeyAddr    addr;
+  bool       press;
+  _Timestamp time;
+};
+
+// A lock-free single-producer, single-consumer ring of `IngestRecord`s, so that events
+// can be reported from interrupt context without blocking, and without disabling
+// interrupts in the scan loop that consumes them. The producer only ever writes
+// `tail_`, and the consumer only ever writes `head_`; each is read by the other side
+// with acquire semantics, and written with release semantics, so a record is completely
+// written before the consumer can see it, and completely read before the producer can
+// reuse its slot. The indices are free-running bytes (the number of records in the ring
+// is their difference), so `_size` must be a power of two, no larger than 128. A size of
+// zero gets the empty ring below, which (because `Plugin` inherits from it) costs
+// nothing.
+template <byte _size, typename _Timestamp = uint16_t>
+class IngestRing {
+  static_assert((_size & (_size - 1)) == 0 && _size <= 128,
+                "IngestRing size must be a power of two, no larger than 128");
+
+ public:
+  typedef IngestRecord<_Timestamp> Record;
+
+  // Producer side. Returns false (and drops the record) if the ring is full.
+  bool push(const Record& record) {
+    byte tail = __atomic_load_n(&tail_, __ATOMIC_RELAXED);
+    byte head = __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
+    if (byte(tail - head) == _size) {
+      return false;
+    }
+    records_[tail & (_size - 1)] = record;
+    __atomic_store_n(&tail_, byte(tail + 1), __ATOMIC_RELEASE);
+    return true;
+  }
+
+  // Consumer side. Returns false if the ring is empty.
+  bool pop(Record& record) {
+    byte head = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+    byte tail = __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+      return false;
+    }
+    record = records_[head & (_size - 1)];
+    __atomic_store_n(&head_, byte(head + 1), __ATOMIC_RELEASE);
+    return true;
+  }
+
+ private:
+  Record records_[_size];
+  byte   head_{0};
+  byte   tail_{0};
+};
+
+template <typename _Timestamp>
+class IngestRing<0, _Timestamp> {
+ public:
+  typedef IngestRecord<_Timestamp> Record;
+
+  bool push(const Record&) { return false; }
+  bool pop(Record&) { return false; }
+};
+
+} // namespace qukeys {
+} // namespace kaleidoglyph {
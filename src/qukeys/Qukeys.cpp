@@ -18,14 +18,51 @@
 namespace kaleidoglyph {
 namespace qukeys {
 
+const PROGMEM Qukey Plugin::empty_qukey{};
+
 // Event handler
 EventHandlerResult Plugin::onKeyswitchEvent(KeyEvent& event) {
-  // This function is a bit misleading. All it does is add the event to the
-  // queue and abort; the processing of the queue now happens in the pre-scan
-  // hook instead. I tried including tests here for events that could bypass the
-  // event queue, but it increases the size of the binary by more than seems
-  // worthwhile (66 bytes).
-  event_queue_.append(event);
+  return queueEvent(event, scanTime());
+}
+
+// Add a keyswitch event that happened at `time` to its source's queue (unless
+// it can bypass it), and flush whatever it allows to be flushed.
+EventHandlerResult Plugin::queueEvent(KeyEvent& event, Timestamp time) {
+  // This function is a bit misleading. Mostly, all it does is add the event to
+  // the queue and abort; the processing of the queue now happens in the
+  // pre-scan hook instead. Testing for events that could bypass the event queue
+  // increases the size of the binary by more than seems worthwhile by default
+  // (66 bytes), so it's only done if `bypass_empty_queue` is set.
+  if (bypass_empty_queue && !hasDeadline()) {
+    updateFlushBudget(scanTime());
+  }
+  if (bypass_empty_queue && !hasDeadline() && withinFlushBudget()) {
+    // If the queue is empty, there's no pending qukey that this event could
+    // affect, and there can't be a release waiting for a tap-hold sequence, so
+    // anything other than the press of a qukey can go straight through. With
+    // more than one source, every source's queue has to be empty, because this
+    // event might change the keymap that the keys in the others are looked up
+    // in. It counts against the flush budget, just as it would if it went
+    // through the queue; once that has run out, it has to wait in the queue
+    // instead.
+    if (event.state.toggledOff()) {
+      countFlushed();
+      recordSentEvent(event);
+      return EventHandlerResult::proceed;
+    }
+    event.key = keymap_[event.addr];
+    if (!isQukeysKey(event.key)) {
+      countFlushed();
+      recordSentEvent(event);
+      return EventHandlerResult::proceed;
+    }
+  } else if (capture_keys && event.state.toggledOn()) {
+    // Look up the key's value now, so the queue can store it.
+    event.key = keymap_[event.addr];
+  }
+  source_ = keySource(event.addr.addr());
+  assert(source_ < source_count);
+  queue().append(event, time);
   // This seemingly-unnecessary call guarantees that the queue can't overflow,
   // even if we get multiple events in a single scan cycle.
   processQueue();
@@ -34,31 +71,110 @@ EventHandlerResult Plugin::onKeyswitchEvent(KeyEvent& event) {
 
 // Run once each scan cycle
 void Plugin::preKeyswitchScan() {
+  // This is the start of a new scan cycle, so the flush budget starts over,
+  // even if the scan time hasn't changed since the last one.
+  restartFlushBudget(scanTime());
+
+  // Events reported through `ingest()` since the last scan cycle get queued
+  // first, just as if they had arrived through `onKeyswitchEvent()`.
+  if (ingest_ring_size != 0) {
+    drainIngestRing();
+  }
+
+  // If the queue is empty, or the deadline set the last time it was processed
+  // hasn't been reached yet, there's nothing to do. Any new keyswitch event gets
+  // processed (and sets a new deadline) as it arrives.
+  if (!deadlineReached()) {
+    return;
+  }
+
   // First, flush any events that we can from the queue.
   processQueue();
 
-  // After that, if there's nothing left in the queue, we're done.
-  if (event_queue_.isEmpty() || release_delayed_for_tap_hold_) {
+  // With `concurrent_resolution`, `processQueue()` has already checked the
+  // timeouts.
+  if (concurrent_resolution) {
     return;
   }
 
-  // Last, check to see if the qukey at the head of the queue has timed out.
-  uint16_t current_time = Controller::scanStartTime();
-  uint16_t elapsed_time = current_time - event_queue_.timestamp(0);
-  if (elapsed_time < hold_timeout) {
-    return;
+  // Last, check to see if the qukey at the head of each source's queue has timed
+  // out, oldest first. Flushing one can change the keymap, which could affect
+  // the others, so they all get processed again in the next scan cycle.
+  bool flushed{false};
+  byte checked{0};
+  for (byte s; (s = oldestSource(checked)) != source_count; checked |= 1 << s) {
+    source_ = s;
+    flushed = flushTimedOutQukey() || flushed;
+  }
+  if (source_count > 1 && flushed) {
+    wakeSources();
+  }
+}
+
+// If the qukey at the head of the queue has timed out, flush it in its hold
+// state, and return true.
+bool Plugin::flushTimedOutQukey() {
+  // If there's nothing left in the queue, there's nothing to do. If the flush
+  // budget has run out, the head of the queue might not even be a qukey any
+  // more; the rest will have to wait for the next scan cycle.
+  if (queue().isEmpty() || source().release_delayed_for_tap_hold ||
+      !withinFlushBudget()) {
+    return false;
+  }
+
+  Timestamp current_time = scanTime();
+  Timestamp elapsed_time = current_time - queue().timestamp(0);
+  if (elapsed_time < holdTimeout(source().head_profile)) {
+    return false;
   }
 
   // The qukey has timed out, so we set the key value depending on which type of
   // qukey it is. For SpaceCadet keys, the modifier is the primary value, but
   // others use the alternate (which isn't necessarily a modifier, but will be
   // in most normal use cases).
-  KeyEvent event = event_queue_.head();
-  Qukey qukey = getQukey(keymap_[event.addr]);
-  event.key = qukey.holdKey();
+  KeyEvent event = queue().head();
+  event.key = holdKey(getQukey(queuedKey(0)));
   event.caller = EventHandlerId::qukeys;
-  event_queue_.shift();
+  recordResolution(Resolution::hold_timeout);
+  countFlushed();
+  shiftQueue();
+  bool changes_keymap = recordSentEvent(event);
   controller_.handleKeyEvent(event);
+  if (changes_keymap) {
+    recaptureKeys();
+  }
+  return true;
+}
+
+// Queue each of the events in the ingest ring, in the order they were reported.
+// Each one keeps the time it was reported, as long as that's not later than the
+// start of this scan cycle (it might be, if it was reported after the scan
+// cycle started), or earlier than the last event already in the queue. Any
+// event that doesn't need to be queued goes straight on to the next handler.
+void Plugin::drainIngestRing() {
+  Timestamp current_time = scanTime();
+  Ingest::Record record;
+  while (Ingest::pop(record)) {
+    Timestamp time = record.time;
+    if (TimestampDifference(current_time - time) < 0) {
+      time = current_time;
+    }
+    source_ = keySource(record.addr.addr());
+    if (!queue().isEmpty()) {
+      Timestamp last_time = queue().timestamp(queue().length() - 1);
+      if (TimestampDifference(time - last_time) < 0) {
+        time = last_time;
+      }
+    }
+    KeyEvent event;
+    event.addr   = record.addr;
+    event.state  = record.press ? cKeyState::press : cKeyState::release;
+    event.key    = cKey::clear;
+    event.caller = EventHandlerId::qukeys;
+    if (queueEvent(event, time) == EventHandlerResult::proceed) {
+      controller_.handleKeyEvent(event);
+    }
+  }
 }
 
 // This function flushes any events that are ready from the queue. In most
@@ -67,10 +183,109 @@ void Plugin::preKeyswitchScan() {
 // the head of the queue is guaranteed to be a qukey press whose state is still
 // indeterminite.
 void Plugin::processQueue() {
-  KeyEvent event;
-  while (updateFlushEvent(event)) {
-    event.caller = EventHandlerId::qukeys;
-    controller_.handleKeyEvent(event);
+  // In a scan cycle in which `preKeyswitchScan()` wasn't called (because there
+  // was no deadline; see `nextDeadline()`), the flush budget starts over the
+  // first time the queue is processed at a new scan time instead.
+  updateFlushBudget(scanTime());
+  if (batch_flush) {
+    processQueueInBatches();
+  } else {
+    KeyEvent event;
+    while (nextFlushEvent(event)) {
+      countFlushed();
+      event.caller = EventHandlerId::qukeys;
+      bool changes_keymap = recordSentEvent(event);
+      controller_.handleKeyEvent(event);
+      if (changes_keymap) {
+        recaptureKeys();
+      }
+    }
+  }
+  if (flush_budget == 0 && !concurrent_resolution) {
+    return;
+  }
+  for (byte s{0}; s < source_count; ++s) {
+    source_ = s;
+    // If the flush budget ran out, make sure the next scan cycle picks up where
+    // this one left off.
+    if (flush_budget != 0 && !withinFlushBudget() && !queue().isEmpty()) {
+      if (deferFlushing()) {
+        recordBudgetHit();
+      }
+      setDeadline(scanTime());
+    }
+    if (concurrent_resolution) {
+      resolvePendingQukeys();
+    }
+  }
+}
+
+// The source with the oldest event at the head of its queue, among those that
+// aren't empty, or in the bitfield `skipped`; `source_count` if there isn't
+// one. On a tie, the lower-numbered source is older.
+byte Plugin::oldestSource(byte skipped) const {
+  Timestamp current_time = scanTime();
+  byte      oldest{source_count};
+  Timestamp oldest_age{0};
+  for (byte s{0}; s < source_count; ++s) {
+    const Queue& event_queue = sources_[s].event_queue;
+    if ((skipped & (1 << s)) || event_queue.isEmpty()) {
+      continue;
+    }
+    Timestamp age = current_time - event_queue.timestamp(0);
+    if (oldest == source_count || age > oldest_age) {
+      oldest     = s;
+      oldest_age = age;
+    }
+  }
+  return oldest;
+}
+
+// Get the next event to flush, if there is one, from whichever source's queue
+// has the oldest event at its head that can be flushed now, so that the events
+// from different sources are merged in the order they arrived. Every source is
+// tried again each time, because flushing an event from one of them can change
+// the keymap, and so what can be flushed from the others.
+bool Plugin::nextFlushEvent(KeyEvent& queued_event) {
+  byte tried{0};
+  for (byte s; (s = oldestSource(tried)) != source_count; tried |= 1 << s) {
+    source_ = s;
+    if (withinFlushBudget() && updateFlushEvent(queued_event)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// With `batch_flush`, the events that `processQueue()` flushes are gathered into
+// runs, each of which is handed to the controller in a single call. A run ends
+// after an event that could change the keymap (the press or release of a key
+// that isn't a keyboard key; see `HeldKeymapKeys`), because the keymap lookup
+// for the next event would otherwise happen too soon. A run also ends when it's as
+// long as the queue: a pass can flush more events than that (multi-tap presses
+// and out-of-order releases don't come out of the queue one for one, and there
+// can be more than one source), and the rest go in the next run.
+void Plugin::processQueueInBatches() {
+  KeyEvent batch[queue_max];
+  bool flushing{true};
+  while (flushing) {
+    byte count{0};
+    bool changes_keymap{false};
+    while ((flushing = nextFlushEvent(batch[count]))) {
+      countFlushed();
+      KeyEvent& event = batch[count++];
+      event.caller = EventHandlerId::qukeys;
+      changes_keymap = recordSentEvent(event);
+      if (changes_keymap || count == queue_max) {
+        break;
+      }
+    }
+    if (count != 0) {
+      sendBatch(controller_, batch, count, BatchFlush<batch_flush>{});
+    }
+    if (changes_keymap) {
+      recaptureKeys();
+    }
   }
 }
 
@@ -80,12 +295,12 @@ void Plugin::processQueue() {
 // or another input event (probably a key release), it returns `false`,
 // signalling `processQueue()` to stop. It is also possible for non-modifier
 // release events without matching press events in the queue to be flushed out
-// of order.
+// of order. The search itself is done by `resolve()`.
 bool Plugin::updateFlushEvent(KeyEvent& queued_event) {
-  if (event_queue_.isEmpty()) {
+  if (queue().isEmpty()) {
     return false;
   }
-  queued_event = event_queue_.head();
+  queued_event = queue().head();
 
   // If the first event in the queue is a release, flush it immediately.
   if (queued_event.state.toggledOff()) {
@@ -93,132 +308,512 @@ bool Plugin::updateFlushEvent(KeyEvent& queued_event) {
     if (waitingForTapHold()) {
       return false;
     }
-    // If not, clear it, and proceed with sending the release event.
-    release_delayed_for_tap_hold_ = false;
-    event_queue_.shift();
+    // If not, clear it, and proceed with sending the release event. If it's the
+    // release of a multi-tap qukey, though, the qukey's press hasn't been sent
+    // yet, so send that (with the key for the number of taps) first, and leave
+    // the release (if it's still in the queue) for the next pass.
+    source().release_delayed_for_tap_hold = false;
+    if (multi_tap_max > 1 && source().tapCount() != 0) {
+      queued_event.state = cKeyState::press;
+      queued_event.key = multiTapKey();
+      source().setTapCount(0);
+      return true;
+    }
+    shiftQueue();
     return true;
   }
 
   // The first event in the queue is a press, so look up its value in the
   // keymap. If it's not a QukeysKey, we can flush it now.
-  queued_event.key = keymap_[queued_event.addr];
+  queued_event.key = queuedKey(0);
   if (!isQukeysKey(queued_event.key)) {
-    event_queue_.shift();
+    shiftQueue();
     return true;
   }
 
   // Now the first event in the queue is a QukeysKey press, so we look up its
-  // corresponding Qukey, and record whether or not it's a SpaceCadet key for
-  // use later.
-  Qukey qukey = getQukey(queued_event.key);
+  // corresponding Qukey (which stays in PROGMEM; only the values we need get
+  // read from it), and record whether or not it's a SpaceCadet key, and which
+  // timing profile it uses, for use later.
+  byte qukey_index = QukeysKey(queued_event.key).data();
+  const Qukey& qukey = getQukey(queued_event.key);
+  byte qukey_flags = readFlags(qukey);
+  bool qukey_is_spacecadet = qukey_flags & Qukey::spacecadet_flag;
+  setHeadProfile(qukey_flags);
 
   // If Qukeys is turned off, translate the QukeysKey at the head of the queue
   // to its primary value (regardless of whether or not it's a SpaceCadet key),
   // then flush it from the queue.
   if (! plugin_active_) {
-    queued_event.key = qukey.primaryKey();
-    event_queue_.shift();
+    queued_event.key = primaryKey(qukey, qukey_is_spacecadet);
+    recordResolution(Resolution::inactive);
+    shiftQueue();
+    return true;
+  }
+
+  // Pick up where the last pass left off (with `concurrent_resolution`, the
+  // qukey's state might already have been determined while it was waiting
+  // behind another one). If that turns up a release that can be flushed out of
+  // order, send that first.
+  PendingQukey& pending = headQukey(qukey_index);
+  if (pending.resolution == Resolution::count && resolve(pending, queued_event)) {
     return true;
   }
 
-  // This is the queue index of the next keypress subsequent to the press of the
-  // qukey at the head of the queue. If it's zero, that means there haven't been
-  // any at the time of the event we're looking at.
-  byte next_keypress_index{0};
+  switch (pending.resolution) {
+    case Resolution::own_release:
+      if (queue().length() == 2) {
+        // The only events in the queue are the press and release of this
+        // qukey. We need to flush and send the press event, but first, we
+        // record that the release should be delayed in case we get a tap-hold
+        // sequence (or more taps, if it's a multi-tap qukey).
+        source().release_delayed_for_tap_hold = true;
+        startMultiTap(qukey_index);
+      }
+      queued_event.key = tapKey(qukey);
+      recordTapDuration(pending.release_index);
+      break;
+    case Resolution::overlap_timeout:
+      queued_event.key = primaryKey(qukey, qukey_is_spacecadet);
+      recordTapDuration(pending.release_index);
+      break;
+    case Resolution::same_zone_press:
+      queued_event.key = tapKey(qukey);
+      break;
+    case Resolution::subsequent_press:
+    case Resolution::hold_timeout:
+      queued_event.key = holdKey(qukey);
+      break;
+    case Resolution::subsequent_release:
+      queued_event.key = alternateKey(qukey, qukey_is_spacecadet);
+      break;
+    default:
+      break;
+  }
+  if (pending.resolution != Resolution::count) {
+    recordResolution(pending.resolution);
+    shiftQueue();
+    // A multi-tap qukey's press doesn't get sent until its taps have been
+    // counted, so carry on with its release, now at the head of the queue.
+    if (multi_tap_max > 1 && source().tapCount() != 0) {
+      return updateFlushEvent(queued_event);
+    }
+    return true;
+  }
+
+  // The queue must always have space for the next event to be added, so if it's
+  // still full at this point, we need to flush the qukey.
+  // The safest thing to do is to use the primary keycode, because someone is
+  // probably mashing on the keys.
+  if (queue().isFull()) {
+    queued_event.key = primaryKey(qukey, qukey_is_spacecadet);
+    recordResolution(Resolution::full_queue);
+    shiftQueue();
+    return true;
+  }
+
+  // Nothing more can happen until the next keyswitch event arrives, or the
+  // qukey's hold timeout (or the release delay of its release) expires.
+  setDeadline(queue().timestamp(0) + holdTimeout(source().head_profile));
+  if (pending.release_index != 0) {
+    Timestamp overlap_start = queue().timestamp(pending.next_keypress_index);
+    Timestamp overlap_end = queue().timestamp(pending.release_index);
+    Timestamp release_timeout =
+        releaseDelay(source().head_profile).timeout(overlap_end - overlap_start);
+    setEarlierDeadline(overlap_end + release_timeout);
+  }
+
+  // Return empty (invalid) event as signal to wait.
+  return false;
+}
 
-  // To make the following code slightly more efficient, record whether or not
-  // the qukey at the head of the queue is a SpaceCadet key.
-  bool qukey_is_spacecadet = qukey.isSpaceCadet();
+// Walk down the queue from where the last pass over the qukey `pending` left
+// off, and determine its state, if there have been any events that cause it to
+// become either primary or alternate; if so, `pending.resolution` records how.
+// The search is incremental: each event in the queue is examined only once for
+// a given qukey, so a pass over a queue that hasn't changed since the last one
+// costs the same no matter how long the queue is. Only the events after the
+// qukey's press count, so a qukey that isn't at the head of the queue is
+// resolved just as it will be once it gets there. If the qukey is at the head
+// of the queue, and `flush_unrelated_releases` is set, this returns true when it
+// has removed a release from the queue that should be flushed out of order,
+// which it stores in `unrelated_release`.
+bool Plugin::resolve(PendingQukey& pending, KeyEvent& unrelated_release) {
+  const Qukey& qukey = qukeyAt(pending.qukey_index);
+  byte qukey_flags = readFlags(qukey);
+  bool qukey_is_spacecadet = qukey_flags & Qukey::spacecadet_flag;
+  byte profile = qukeyProfile(qukey_flags);
+  ReleaseDelay release_delay = releaseDelay(profile);
+  KeyAddr qukey_addr = queue().addr(pending.press_index);
+  byte qukey_zone = keyZone(qukey_addr.addr());
+
+  // The events before `scan_index` have already been examined on a previous
+  // pass, and none of them determined the qukey's state at the time, but a
+  // release of the qukey that was delayed waiting for more overlap might have
+  // timed out since. (With `concurrent_resolution`, the timeouts are checked
+  // against the timestamp of each event instead; see `timedOut()`.)
+  if (!concurrent_resolution && pending.release_index != 0) {
+    Timestamp overlap_start = queue().timestamp(pending.next_keypress_index);
+    Timestamp overlap_end = queue().timestamp(pending.release_index);
+    if (!release_delay.enabled() ||
+        !releaseDelayed(overlap_start, overlap_end, release_delay)) {
+      pending.resolution = Resolution::overlap_timeout;
+      return false;
+    }
+  }
 
-  // Now we walk down the queue, and determine the state of the qukey, if there
-  // have been any events that cause it to become either primary or alternate.
-  for (byte i{1}; i < event_queue_.length(); ++i) {
+  for (; pending.scan_index < queue().length(); ++pending.scan_index) {
+    byte i = pending.scan_index;
+    if (concurrent_resolution &&
+        timedOut(pending, profile, release_delay, queue().timestamp(i))) {
+      return false;
+    }
     // First deal with key press events:
-    if (event_queue_.isPress(i)) {
+    if (queue().isPress(i)) {
       if (qukey_is_spacecadet) {
-        queued_event.key = qukey.primaryKey();
-        event_queue_.shift();
-        return true;
+        pending.resolution = Resolution::subsequent_press;
+        return false;
       }
-      if (next_keypress_index == 0) {
-        next_keypress_index = i;
+      // With bilateral resolution, a press in the same zone means the qukey is
+      // being typed, not held as a modifier.
+      if (bilateral_resolution &&
+          keyZone(queue().addr(i).addr()) == qukey_zone) {
+        pending.resolution = Resolution::same_zone_press;
+        return false;
+      }
+      // Record the queue index of the first keypress subsequent to the press of
+      // the qukey.
+      if (pending.next_keypress_index == 0) {
+        pending.next_keypress_index = i;
       }
       continue;
     }
-    // event_queue_[i] is a release event
+    // The event at `i` is a release
 
     // If this is a release of the qukey
-    if (event_queue_.addr(i) == queued_event.addr) {
-      if (next_keypress_index == 0 || overlap_required_ == 0) {
-        if (event_queue_.length() == 2) {
-          // The only events in the queue are the press and release of this
-          // qukey. We need to flush and send the press event, but first, we
-          // record that the release should be delayed in case we get a tap-hold
-          // sequence.
-          release_delayed_for_tap_hold_ = true;
-        }
+    if (queue().addr(i) == qukey_addr) {
+      if (pending.next_keypress_index == 0 || !release_delay.enabled()) {
         // there were no keypresses between the qukey press and its release, or
         // there's no release delay overlap configured.
-        queued_event.key = qukey_is_spacecadet ? qukey.alternateKey() : qukey.primaryKey();
-        event_queue_.shift();
-        return true;
+        pending.resolution = Resolution::own_release;
+        pending.release_index = i;
+        return false;
       }
+      // If an earlier release of the qukey is already waiting for its release
+      // delay to time out, this one can't time out before it does.
+      if (pending.release_index != 0) {
+        continue;
+      }
+      pending.release_index = i;
       // calculate release delay and check to see if it has timed out
-      uint16_t overlap_start = event_queue_.timestamp(next_keypress_index);
-      uint16_t overlap_end = event_queue_.timestamp(i);
-      if (releaseDelayed(overlap_start, overlap_end)) {
+      Timestamp overlap_start = queue().timestamp(pending.next_keypress_index);
+      Timestamp overlap_end = queue().timestamp(i);
+      if (concurrent_resolution ||
+          releaseDelayed(overlap_start, overlap_end, release_delay)) {
         continue;
       }
-      queued_event.key = qukey.primaryKey();
-      event_queue_.shift();
-      return true; 
-    }
-
-    for (byte j{1}; j < i; ++j) {
-      if (event_queue_.isPress(j) &&
-          event_queue_.addr(j) == event_queue_.addr(i)) {
-        // event_queue_[i] is a release of a key that was pressed subsequent
-        // to the qukey
-        queued_event.key = qukey.alternateKey();
-        event_queue_.shift();
-        return true;
+      pending.resolution = Resolution::overlap_timeout;
+      return false;
+    }
+
+    // If the press of this key is also in the queue after the qukey's press,
+    // the event at `i` is a release of a key that was pressed subsequent to the
+    // qukey. (It can't be the qukey's own press; that case was handled above.)
+    // For the qukey at the head of the queue, that's a single bit test.
+    if (queue().isPaired(i)) {
+      byte j = i;
+      if (pending.press_index != 0) {
+        while (--j > pending.press_index &&
+               queue().addr(j) != queue().addr(i)) {}
+      }
+      if (j > pending.press_index) {
+        pending.resolution = Resolution::subsequent_release;
+        return false;
       }
     }
 
-    // A key was released that is not in the queue. If it's not a modifier key
-    // (including layer shifts), we could send the release event out of
+    // A key was released that is not in the queue (or, for a qukey behind the
+    // head, whose press is ahead of the qukey's). If it's not a modifier key
+    // (including layer shifts), we can send the release event out of
     // order. Without doing so, it is possible to get a tapped non-modifier to
     // repeat because of rollover to a qukey that is held. It also reduces the
     // probability of filling up the event queue (and thus prematurely flushing
-    // a qukey in its primary state). However, doing so complicates the code,
-    // increases PROGMEM usage by 82 bytes, and weakens the guarantee we can
-    // make about preserving keyswitch event order.
+    // a qukey in its primary state). However, doing so increases PROGMEM usage
+    // by 82 bytes, and weakens the guarantee we can make about preserving
+    // keyswitch event order, so it's only done if `flush_unrelated_releases` is
+    // set. A qukey's release stays in order, too, because it might have been
+    // flushed as a modifier. Removing the release leaves `scan_index` pointing
+    // at the event that followed it, so the next pass picks up from there.
+    // Only the qukey at the head of the queue can do that; a qukey behind it
+    // stops here instead, because the release might be flushed out of order by
+    // the time the qukey reaches the head, so it has to be examined again then.
+    if (flush_unrelated_releases) {
+      if (pending.press_index != 0) {
+        return false;
+      }
+      Key key = keymap_[queue().addr(i)];
+      if (!isModifierKey(key) && !isLayerShiftKey(key) && !isQukeysKey(key)) {
+        unrelated_release.addr  = queue().addr(i);
+        unrelated_release.state = cKeyState::release;
+        unrelated_release.key   = key;
+        removeFromQueue(i);
+        return true;
+      }
+    }
   }
 
-  // The queue must always have space for the next event to be added, so if it's
-  // still full at this point, we need to flush the qukey. The safest thing to
-  // do is to use the primary keycode, because someone is probably mashing on
-  // the keys.
-  if (event_queue_.isFull()) {
-    queued_event.key = qukey.primaryKey();
-    event_queue_.shift();
+  if (concurrent_resolution) {
+    timedOut(pending, profile, release_delay, scanTime());
+  }
+  return false;
+}
+
+// With `concurrent_resolution`, a qukey's timeouts are measured against the
+// timestamps of the events that follow it: any event at or after the time the
+// qukey's hold timeout (or the release delay of its release) expires comes too
+// late to affect it, just as it would if the qukey had been at the head of the
+// queue, and `preKeyswitchScan()` had flushed it as soon as the timeout expired.
+// If either one has expired by `time`, this records which one did first (the
+// release delay, if they expired at the same time), and returns true.
+bool Plugin::timedOut(PendingQukey& pending, byte profile,
+                      const ReleaseDelay& release_delay, Timestamp time) const {
+  Timestamp press_time = queue().timestamp(pending.press_index);
+  Timestamp elapsed_time = time - press_time;
+  Timestamp hold_time = holdTimeout(profile);
+  if (pending.release_index != 0) {
+    Timestamp overlap_start = queue().timestamp(pending.next_keypress_index);
+    Timestamp overlap_end = queue().timestamp(pending.release_index);
+    Timestamp release_time = (overlap_end - press_time) +
+                             release_delay.timeout(overlap_end - overlap_start);
+    if (elapsed_time >= release_time && release_time <= hold_time) {
+      pending.resolution = Resolution::overlap_timeout;
+      return true;
+    }
+  }
+  if (elapsed_time >= hold_time) {
+    pending.resolution = Resolution::hold_timeout;
     return true;
   }
+  return false;
+}
 
-  // Return empty (invalid) event as signal to wait.
+// The tracked state of the qukey at the head of the queue, whose index in the
+// qukey table is `qukey_index`. If there isn't one, or it's for a different
+// qukey (because the keymap changed while the qukey was in the queue), it
+// starts over.
+Plugin::PendingQukey& Plugin::headQukey(byte qukey_index) {
+  if (source().pending_count == 0 || source().pending[0].press_index != 0) {
+    // Only the head qukey is tracked unless `concurrent_resolution` is set, so
+    // there's nothing to move out of the way otherwise.
+    if (concurrent_resolution) {
+      for (byte n{source().pending_count}; n > 0; --n) {
+        source().pending[n] = source().pending[n - 1];
+      }
+    }
+    ++source().pending_count;
+  } else if (source().pending[0].qukey_index == qukey_index) {
+    return source().pending[0];
+  }
+  source().pending[0] = {0, qukey_index, 1, 0, 0, Resolution::count};
+  if (source().tracked_count == 0) {
+    source().tracked_count = 1;
+  }
+  return source().pending[0];
+}
+
+// With `concurrent_resolution`, start tracking any qukey presses that have been
+// added to the queue since the last pass, then resolve every qukey behind the
+// head of the queue as far as the events that follow it allow, so that each
+// one's state is already known by the time it reaches the head.
+void Plugin::resolvePendingQukeys() {
+  for (; source().tracked_count < queue().length(); ++source().tracked_count) {
+    byte i = source().tracked_count;
+    if (queue().isRelease(i)) {
+      continue;
+    }
+    Key key = queuedKey(i);
+    if (isQukeysKey(key)) {
+      source().pending[source().pending_count++] =
+          {i, QukeysKey(key).data(), byte(i + 1), 0, 0, Resolution::count};
+    }
+  }
+  KeyEvent unused;
+  for (byte n{0}; n < source().pending_count; ++n) {
+    PendingQukey& pending = source().pending[n];
+    if (pending.press_index != 0 && pending.resolution == Resolution::count) {
+      resolve(pending, unused);
+    }
+  }
+}
+
+// Remove the event at the head of the queue.
+void Plugin::shiftQueue() {
+  recordDwell((scanTime() - queue().timestamp(0)) / timestamp_ticks_per_ms);
+  queue().shift();
+  forgetEvent(0);
+}
+
+// Remove the event at `index` (a release that's being flushed out of order).
+void Plugin::removeFromQueue(byte index) {
+  recordDwell((scanTime() - queue().timestamp(index)) / timestamp_ticks_per_ms);
+  queue().remove(index);
+  forgetEvent(index);
+}
+
+// The event at `index` has left the queue, so every later event has moved down
+// one place. If it was a tracked qukey's press, whatever was learned about that
+// qukey no longer applies.
+void Plugin::forgetEvent(byte index) {
+  auto forget = [index](byte& i) {
+    if (i > index) {
+      --i;
+    }
+  };
+  byte kept{0};
+  for (byte n{0}; n < source().pending_count; ++n) {
+    PendingQukey pending = source().pending[n];
+    if (pending.press_index == index) {
+      continue;
+    }
+    forget(pending.press_index);
+    forget(pending.scan_index);
+    forget(pending.next_keypress_index);
+    forget(pending.release_index);
+    source().pending[kept++] = pending;
+  }
+  source().pending_count = kept;
+  if (source().tracked_count > index) {
+    --source().tracked_count;
+  }
+}
+
+// The qukey at the head of the queue was tapped, and its release is at
+// `release_index`; if the hold timeout is adaptive, and this qukey uses it, feed
+// the tap's duration into the estimate. With `concurrent_resolution`, the qukeys
+// behind it might have been resolved using the old timeout, so if it changes,
+// they start over. So do the qukeys from other sources, whose deadlines were set
+// using the old timeout, too.
+void Plugin::recordTapDuration(byte release_index) {
+  if (adaptive_hold_timeout && source().head_profile == 0) {
+    uint16_t previous_timeout = HoldTimeout::timeout();
+    HoldTimeout::recordTap((queue().timestamp(release_index) - queue().timestamp(0)) /
+                           timestamp_ticks_per_ms);
+    if (HoldTimeout::timeout() == previous_timeout) {
+      return;
+    }
+    if (source_count > 1) {
+      byte current = source_;
+      for (byte s{0}; s < source_count; ++s) {
+        source_ = s;
+        if (s != current) {
+          setDeadline(scanTime());
+          resetResolution();
+        }
+      }
+      source_ = current;
+    }
+    if (concurrent_resolution) {
+      source().pending_count = 1;
+      source().tracked_count = 1;
+    }
+  }
+}
+
+// With `capture_keys`, an event that could have changed the keymap has just been
+// flushed, so the captured value of every press still in the queue (in any source's
+// queue) might be out of date. Look them all up again, as if they'd only just been
+// queued.
+void Plugin::recaptureKeys() {
+  if (!capture_keys) {
+    return;
+  }
+  for (Source& source : sources_) {
+    Queue& event_queue = source.event_queue;
+    for (byte i{0}; i < event_queue.length(); ++i) {
+      if (event_queue.isPress(i)) {
+        event_queue.setKey(i, keymap_[event_queue.addr(i)]);
+      }
+    }
+  }
+}
+
+void Plugin::resetResolution() {
+  source().pending_count = 0;
+  source().tracked_count = 0;
+}
+
+bool Plugin::hasDeadline() const {
+  for (const Source& source : sources_) {
+    if (!source.event_queue.isEmpty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Timestamp Plugin::nextDeadline() const {
+  Timestamp current_time = scanTime();
+  Timestamp deadline{sources_[0].next_deadline};
+  bool      found{false};
+  for (const Source& source : sources_) {
+    if (source.event_queue.isEmpty()) {
+      continue;
+    }
+    if (!found || TimestampDifference(source.next_deadline - current_time) <
+                  TimestampDifference(deadline - current_time)) {
+      deadline = source.next_deadline;
+      found    = true;
+    }
+  }
+  return deadline;
+}
+
+// Whether any source's queue needs to be processed in this scan cycle.
+bool Plugin::deadlineReached() const {
+  Timestamp current_time = scanTime();
+  for (const Source& source : sources_) {
+    if (!source.event_queue.isEmpty() &&
+        TimestampDifference(current_time - source.next_deadline) >= 0) {
+      return true;
+    }
+  }
   return false;
 }
 
-bool Plugin::releaseDelayed(uint16_t overlap_start, uint16_t overlap_end) const {
-  uint16_t overlap_duration = overlap_end - overlap_start;
-  uint32_t limit = (overlap_duration * 100) / overlap_required_;
-  limit -= overlap_duration;
-  uint8_t  release_timeout = (limit < 256) ? limit : 255;
-  uint16_t current_time = Controller::scanStartTime();
-  uint16_t elapsed_time = current_time - overlap_end;
+void Plugin::wake() {
+  wakeSources();
+  for (byte s{0}; s < source_count; ++s) {
+    source_ = s;
+    resetResolution();
+  }
+}
+
+// Make sure every source's queue gets processed in the next scan cycle.
+void Plugin::wakeSources() {
+  for (Source& source : sources_) {
+    source.next_deadline = scanTime();
+  }
+}
+
+bool Plugin::releaseDelayed(Timestamp overlap_start, Timestamp overlap_end,
+                            const ReleaseDelay& release_delay) const {
+  Timestamp overlap_duration = overlap_end - overlap_start;
+  Timestamp release_timeout = release_delay.timeout(overlap_duration);
+  Timestamp current_time = scanTime();
+  Timestamp elapsed_time = current_time - overlap_end;
   return (elapsed_time < release_timeout);
 }
 
+void Plugin::setDeadline(Timestamp deadline) {
+  source().next_deadline = deadline;
+}
+
+void Plugin::setEarlierDeadline(Timestamp deadline) {
+  if (TimestampDifference(deadline - source().next_deadline) < 0) {
+    source().next_deadline = deadline;
+  }
+}
+
 
 // Return false to signal that the release event at the head of the queue should
 // proceed, and true if it should be delayed until the state of the potential
@@ -226,76 +821,143 @@ bool Plugin::releaseDelayed(uint16_t overlap_start, uint16_t overlap_end) const
 bool Plugin::waitingForTapHold() {
   // This must only be called if the event queue has already been determined to
   // be not empty, and the first event is the release of a qukey.
-  assert(event_queue_.length > 0);
-  assert(event_queue_.isRelease(0));
+  assert(queue().length() > 0);
+  assert(queue().isRelease(0));
 
   // If there's not potential tap-hold waiting for a timeout, proceed.
-  if (! release_delayed_for_tap_hold_) {
+  if (! source().release_delayed_for_tap_hold) {
     return false;
   }
 
   // These helper variables are here to improve code clarity. It's possible that
   // the binary would be different if I only declared them when necessary; I
   // should check.
-  uint16_t current_time = Controller::scanStartTime();
-  uint16_t elapsed_time;
+  Timestamp current_time = scanTime();
+  Timestamp elapsed_time;
+
+  // If it's a multi-tap qukey, count each complete tap that follows: a press
+  // within the tap-hold timeout of the release before it, and a release within
+  // the timeout of that press. Only the release of the last one needs to stay
+  // in the queue.
+  while (multi_tap_max > 1 && source().tapCount() != 0 && queue().length() > 2 &&
+         queue().addr(1) == queue().addr(0) && queue().isPress(1) &&
+         queue().addr(2) == queue().addr(0) && queue().isRelease(2) &&
+         Timestamp(queue().timestamp(1) - queue().timestamp(0)) <=
+             tapHoldTimeout() &&
+         Timestamp(queue().timestamp(2) - queue().timestamp(1)) <=
+             tapHoldTimeout()) {
+    source().setTapCount(source().tapCount() + 1);
+    shiftQueue();
+    shiftQueue();
+    if (multiTapDone()) {
+      return false;
+    }
+  }
 
   // If there's only one event in the queue (the qukey release event), we only
   // need to check to see if it has timed out.
-  if (event_queue_.length() == 1) {
-    elapsed_time = current_time - event_queue_.timestamp(0);
-    if (elapsed_time > tap_hold_timeout) {
+  if (queue().length() == 1) {
+    elapsed_time = current_time - queue().timestamp(0);
+    if (elapsed_time > tapHoldTimeout()) {
       // The release event has timed out.
       return false;
     }
-    // If it hasn't timed out yet, we're done.
+    // If it hasn't timed out yet, we're done until it does.
+    setDeadline(queue().timestamp(0) + tapHoldTimeout() + 1);
     return true;
   }
 
-  // If there are any events in the queue from keys other than the qukey, give
-  // up; it gets needlessly complicated if we try to support rollover.
-  for (byte i{1}; i < event_queue_.length(); ++i) {
-    if (event_queue_.addr(i) != event_queue_.addr(0)) {
+  // If there are three (or possibly more) events in the queue, the qukey has
+  // been tapped twice, or other keys have been pressed; either way, give up. If
+  // the second event in the queue is from a key other than the qukey, give up
+  // too; it gets needlessly complicated if we try to support rollover.
+  if (queue().length() > 2 ||
+      queue().addr(1) != queue().addr(0)) {
+    return false;
+  }
+
+  // The queue holds just the qukey's release and its second press. Check to see
+  // if it has timed out.
+  elapsed_time = current_time - queue().timestamp(1);
+  if (elapsed_time > tapHoldTimeout()) {
+    // This is a tap-hold composite event; to turn it into a single press &
+    // hold in the output, we just need to remove the first two events from the
+    // queue.
+    queue().clear();
+    resetResolution();
+    source().release_delayed_for_tap_hold = false;
+    // A multi-tap qukey's press still has to be sent, with the key for the
+    // number of taps before this one.
+    if (multi_tap_max > 1 && source().tapCount() != 0) {
       return false;
     }
+    // There's nothing left in the queue, and we're not technically waiting to
+    // decide on a tap-hold, but we need to return true here anyway as a signal
+    // that processing of the queue should stop because it's empty.
+    return true;
   }
+  setDeadline(queue().timestamp(1) + tapHoldTimeout() + 1);
+  return true;
+}
 
-  // The queue is a series of alternating release and press events, all on the
-  // same key, starting with the first release. What we do next only depends on
-  // the number of events in the queue.
-  if (event_queue_.length() == 2) {
-    // Just one release and the second press. Check to see if it has timed out.
-    elapsed_time = current_time - event_queue_.timestamp(1);
-    if (elapsed_time > tap_hold_timeout) {
-      // This is a tap-hold composite event; to turn it into a single press &
-      // hold in the output, we just need to remove the first two events from
-      // the queue.
-      event_queue_.clear();
-      release_delayed_for_tap_hold_ = false;
-      // There's nothing left in the queue, and we're not technically waiting to
-      // decide on a tap-hold, but we need to return true here anyway as a
-      // signal that processing of the queue should stop because it's empty.
+// If the qukey at `qukey_index` in the qukey table has multi-tap keys, start
+// counting its taps.
+void Plugin::startMultiTap(byte qukey_index) {
+  if (multi_tap_max < 2) {
+    return;
+  }
+  for (byte i{0}; i < multiTapCount(); ++i) {
+    if (readFromProgmem(multiTapTable()[i].qukey_index_) == qukey_index) {
+      source().setTapEntry(i);
+      source().setTapCount(1);
+      if (multiTapDone()) {
+        source().setTapCount(0);
+      }
+      return;
     }
-    return true;
   }
+}
 
-  // If we get here, there are three (or possibly more) events in the queue, so
-  // the qukey has been tapped twice.
-  return false;
+// The key for the number of taps counted so far: the qukey's own tap key for a
+// single tap. Without multi-tap keys, there's no table to look it up in (and no
+// count, so it's never called).
+Key Plugin::multiTapKey() const {
+  if (multi_tap_max < 2) {
+    return cKey::clear;
+  }
+  const MultiTap& multi_tap = multiTapTable()[source().tapEntry()];
+  if (source().tapCount() == 1) {
+    return tapKey(qukeyAt(readFromProgmem(multi_tap.qukey_index_)));
+  }
+  return readFromProgmem(multi_tap.keys_[byte(source().tapCount() - 2)]);
 }
 
+// Whether there's no key for another tap, so the count is over.
+bool Plugin::multiTapDone() const {
+  if (multi_tap_max < 2) {
+    return true;
+  }
+  const MultiTap& multi_tap = multiTapTable()[source().tapEntry()];
+  byte next = source().tapCount() - 1;
+  return (next >= MultiTap::max_keys ||
+          readFromProgmem(multi_tap.keys_[next]) == cKey::clear);
+}
 
-// return the Qukey object corresponding to the QukeysKey
-Qukey Plugin::getQukey(Key key) const {
+// Return the Qukey (in PROGMEM) corresponding to the QukeysKey.
+const Qukey& Plugin::getQukey(Key key) const {
   assert(isQukeysKey(key));
+  return qukeyAt(QukeysKey(key).data());
+}
 
-  byte qukey_index = QukeysKey(key).data();
-  if (qukey_index < qukey_count_)
-    return readFromProgmem(qukeys_[qukey_index]);
-
-  // We should never get here, but there's nothing stopping the sketch from
-  // having a QukeysKey with index data that's out of bounds.
-  return Qukey{};
+// Return the Qukey (in PROGMEM) at `qukey_index` in the qukey table. We should
+// never get an index that's out of range, but there's nothing stopping the
+// sketch from having a QukeysKey with index data that's out of bounds (only
+// `QukeyTable::key()` checks it), so that gets an empty Qukey.
+const Qukey& Plugin::qukeyAt(byte qukey_index) const {
+  if (qukey_index < qukey_count_) {
+    return qukeys_[qukey_index];
+  }
+  return empty_qukey;
 }
 
 } // namespace qukeys {
@@ -1,5 +1,7 @@
 // -*- c++ -*-
 
+#pragma once
+
 #include <Arduino.h>
 
 #include <kaleidoglyph/Controller.h>
@@ -10,6 +12,7 @@
 #include <kaleidoglyph/Plugin.h>
 #include <kaleidoglyph/cKey.h>
 #include <kaleidoglyph/EventHandlerId.h>
+#include <kaleidoglyph/utils.h>
 #include "qukeys/EventQueue.h"
 
 // static_assert(EventHandlerId::qukeys, "Missing definition");
@@ -34,79 +37,474 @@
 #endif
 // -------------------------------------------------------------------------------------
 
+#include "qukeys/AdaptiveHoldTimeout.h"
+#include "qukeys/FlushBudget.h"
+#include "qukeys/IngestRing.h"
 #include "qukeys/QukeysKey.h"
+#include "qukeys/Stats.h"
 
 namespace kaleidoglyph {
 namespace qukeys {
 
-// Qukey structure
+// The type of the timestamps of queued events (see `timestamp_ticks_per_ms`), the
+// signed type of the difference between two of them, which is what's compared to tell
+// which of two timestamps is earlier, across the clock's wraparound, and the type that
+// `ReleaseDelay` multiplies them in.
+template <bool _ticks>
+struct TimestampType {
+  typedef uint16_t type;
+  typedef int16_t  difference_type;
+  typedef uint32_t product_type;
+};
+template <>
+struct TimestampType<true> {
+  typedef uint32_t type;
+  typedef int32_t  difference_type;
+  typedef uint64_t product_type;
+};
+typedef TimestampType<(timestamp_ticks_per_ms > 1)>::type            Timestamp;
+typedef TimestampType<(timestamp_ticks_per_ms > 1)>::difference_type TimestampDifference;
+
+// The number of bits needed to count to `n` (i.e. log2(n), rounded up)
+constexpr byte bitsToCount(uint32_t n) {
+  return (n > 1) ? 1 + bitsToCount((n + 1) / 2) : 0;
+}
+
+// The release delay for a given minimum overlap percentage `p`. When a qukey is released
+// while a subsequent key is still held, its release is delayed long enough that the
+// subsequent key's press could still reach `p` percent of the overlap:
+//
+//   delay = min(255ms, floor(overlap * (100 - p) / p))  (timestamp ticks)
+//
+// That's computed here without division, from two values precomputed (once, by the
+// constructor) for `p`: `saturation_`, the shortest overlap for which the delay reaches
+// 255ms; and `multiplier_`, (100 - p) / p, rounded up, with 22 fractional bits (plus one
+// for each doubling of `timestamp_ticks_per_ms`). For any overlap shorter than
+// `saturation_` (at most 25245ms, with `p == 99`), the product fits in 32 bits (64, with
+// more than one tick per millisecond), and the rounding error is too small to change the
+// result. A percentage of 0 (or 100 or more) turns the release delay off.
+class ReleaseDelay {
+ public:
+  constexpr explicit
+  ReleaseDelay(byte overlap_required = 0)
+      : multiplier_(isEnabled(overlap_required)
+                    ? ((Product(100 - overlap_required) << fraction_bits) +
+                       overlap_required - 1) / overlap_required
+                    : 0),
+        saturation_(isEnabled(overlap_required)
+                    ? (uint32_t(max_timeout) * overlap_required +
+                       (100 - overlap_required) - 1) / (100 - overlap_required)
+                    : 0) {}
+
+  bool enabled() const {
+    return saturation_ != 0;
+  }
+  // Only meaningful if `enabled()`
+  Timestamp timeout(Timestamp overlap_duration) const {
+    if (overlap_duration >= saturation_) {
+      return max_timeout;
+    }
+    return (overlap_duration * multiplier_) >> fraction_bits;
+  }
+
+ private:
+  typedef TimestampType<(timestamp_ticks_per_ms > 1)>::product_type Product;
+
+  static constexpr Timestamp max_timeout = 255 * Timestamp(timestamp_ticks_per_ms);
+  static constexpr byte fraction_bits = 22 + bitsToCount(timestamp_ticks_per_ms);
+
+  Product   multiplier_;
+  Timestamp saturation_;
+
+  static constexpr bool isEnabled(byte overlap_required) {
+    return overlap_required > 0 && overlap_required < 100;
+  }
+};
+
+// A qukey timing profile: the timeouts and minimum overlap to use for the qukeys that
+// refer to it, in place of `hold_timeout`, `tap_hold_timeout` and the overlap set with
+// `Plugin::setMinimumOverlap()`. Qukeys refer to profiles by number, starting from 1;
+// profile 0 is always those global settings. For example, to give the pinkies more
+// time, and to let a thumb layer-shift engage quickly:
+//
+//   const PROGMEM QukeyProfile qukey_profiles[] = {
+//     {250, 200, 80},  // 1: pinkies
+//     {120, 150, 50},  // 2: thumbs
+//   };
+//
+// With `compact_timestamps`, the timeouts are clamped to what a one-byte timestamp
+// offset can represent: 256 timestamp ticks for the hold timeout, and 255 for the
+// tap-hold timeout (see `compact_timestamps` and `timestamp_ticks_per_ms`).
+class QukeyProfile {
+ public:
+  constexpr
+  QukeyProfile(uint16_t hold_timeout, byte tap_hold_timeout, byte overlap_required)
+      : hold_timeout_(clamp(hold_timeout, max_hold_timeout)),
+        tap_hold_timeout_(clamp(tap_hold_timeout, max_tap_hold_timeout)),
+        overlap_required_(overlap_required < 100 ? overlap_required : 0),
+        release_delay_(overlap_required) {}
+
+  // These are only for `QukeyProfile` objects in RAM.
+  uint16_t holdTimeout() const {
+    return hold_timeout_;
+  }
+  byte tapHoldTimeout() const {
+    return tap_hold_timeout_;
+  }
+  byte overlapRequired() const {
+    return overlap_required_;
+  }
+
+ private:
+  static constexpr uint16_t max_hold_timeout =
+      compact_timestamps ? 256 / timestamp_ticks_per_ms : 0xFFFF;
+  static constexpr byte max_tap_hold_timeout =
+      compact_timestamps ? 255 / timestamp_ticks_per_ms : 255;
+
+  uint16_t     hold_timeout_;
+  byte         tap_hold_timeout_;
+  byte         overlap_required_;
+  ReleaseDelay release_delay_;
+
+  static constexpr uint16_t clamp(uint16_t timeout, uint16_t max_timeout) {
+    return (timeout < max_timeout) ? timeout : max_timeout;
+  }
+
+  friend class Plugin;
+};
+
+// Qukey structure. A qukey is defined by its primary and alternate `Key` values, but
+// what the engine needs to know when it resolves one is which of them to use for a tap
+// and which for a hold, and that depends on whether it's a SpaceCadet key (one whose
+// primary value is a modifier or a layer shift). So that's what gets stored, all of it
+// computed at compile time for a `constexpr` (PROGMEM) qukey table. The SpaceCadet flag
+// shares a byte with the qukey's timing profile number, so that the engine gets both
+// with a single read.
 class Qukey {
  public:
+  static constexpr byte max_profile{0x7F};
+
   constexpr
   Qukey() = default;
   constexpr
-  Qukey(const Qukey& other)
-      : primary_key_(other.primary_key_), alternate_key_(other.alternate_key_) {}
-  constexpr
-  Qukey(Key primary_key, Key alternate_key)
-      : primary_key_(primary_key), alternate_key_(alternate_key) {}
+  Qukey(Key primary_key, Key alternate_key, byte profile = 0)
+      : tap_key_(isSpaceCadet(primary_key) ? alternate_key : primary_key),
+        hold_key_(isSpaceCadet(primary_key) ? primary_key : alternate_key),
+        flags_((isSpaceCadet(primary_key) ? spacecadet_flag : 0) |
+               (profile & max_profile)) {}
 
+  // These are only for `Qukey` objects in RAM; see `Plugin` for the PROGMEM versions.
   Key primaryKey() const {
-    return primary_key_;
+    return isSpaceCadet() ? hold_key_ : tap_key_;
   }
   Key alternateKey() const {
-    return alternate_key_;
+    return isSpaceCadet() ? tap_key_ : hold_key_;
   }
   bool isSpaceCadet() const {
-    // If the primary `Key` value is a modifier, treat this key as a SpaceCadet key
-    return (isModifierKey(primary_key_) || isLayerShiftKey(primary_key_));
+    return flags_ & spacecadet_flag;
+  }
+  byte profile() const {
+    return flags_ & max_profile;
   }
   Key tapKey() const {
-    return isSpaceCadet() ? alternateKey() : primaryKey();
+    return tap_key_;
   }
   Key holdKey() const {
-    return isSpaceCadet() ? primaryKey() : alternateKey();
+    return hold_key_;
+  }
+
+ private:
+  static constexpr byte spacecadet_flag{0x80};
+
+  Key  tap_key_{cKey::clear};
+  Key  hold_key_{cKey::clear};
+  byte flags_{0};
+
+  // If the primary `Key` value is a modifier, treat this key as a SpaceCadet key
+  static constexpr bool isSpaceCadet(Key primary_key) {
+    return (isModifierKey(primary_key) || isLayerShiftKey(primary_key));
+  }
+
+  friend class Plugin;
+};
+
+// A table of qukey definitions, meant to be stored in PROGMEM:
+//
+//   const PROGMEM QukeyTable<2> qukey_defs = {{
+//     {Key_F, Key_LeftShift},  // 0
+//     {Key_J, Key_RightShift}, // 1
+//   }};
+//
+// `QukeysKey` values for the keymap should come from `key<index>()`, which checks the
+// index at compile time. A `QukeysKey` constructed directly isn't checked; if its index
+// is out of range, `Plugin` treats it as a qukey whose keys are both `cKey::clear`.
+template <byte _count>
+struct QukeyTable {
+  static_assert(_count > 0, "A QukeyTable must have at least one entry");
+
+  Qukey entries[_count];
+
+  static constexpr byte count() {
+    return _count;
+  }
+  template <byte _index>
+  static constexpr QukeysKey key() {
+    static_assert(_index < _count, "Qukey index out of range");
+    return QukeysKey(_index);
+  }
+};
+
+// Multi-tap keys for a qukey: the keys it produces when it's tapped two (or more) times in
+// a row, instead of its tap key, for up to `multi_tap_max` taps. The keys are listed by
+// number of taps, starting with two, and the list ends at the first `cKey::clear`:
+//
+//   const PROGMEM MultiTapTable<1> multi_taps = {{
+//     {0, Key_Escape, Key_CapsLock},  // qukey 0: Escape on a double tap, CapsLock on a triple
+//   }};
+//
+// The table is given to the plugin with `Plugin::setMultiTaps()`.
+class MultiTap {
+ public:
+  static constexpr byte max_keys = (multi_tap_max > 1) ? multi_tap_max - 1 : 1;
+
+  template <typename... _Keys>
+  constexpr
+  MultiTap(byte qukey_index, _Keys... keys)
+      : qukey_index_(qukey_index), keys_{keys...} {}
+
+  // These are only for `MultiTap` objects in RAM.
+  byte qukeyIndex() const {
+    return qukey_index_;
+  }
+  // The key for `taps` taps, or `cKey::clear` if there isn't one (as there never is for
+  // fewer than two)
+  Key key(byte taps) const {
+    return (taps >= 2 && taps - 2 < max_keys) ? keys_[taps - 2] : cKey::clear;
+  }
+
+ private:
+  byte qukey_index_;
+  Key  keys_[max_keys];
+
+  friend class Plugin;
+};
+
+template <byte _count>
+struct MultiTapTable {
+  MultiTap entries[_count];
+
+  static constexpr byte count() {
+    return _count;
+  }
+};
+
+// The multi-tap table that the plugin was given (in PROGMEM), and the number of entries
+// in it. With a `multi_tap_max` of 1, there's no table, and this is empty, so (because
+// `Plugin` inherits from it) it costs nothing.
+template <bool _enabled>
+class MultiTaps {
+ public:
+  void setMultiTapTable(const MultiTap* entries, byte count) {
+    entries_ = entries;
+    count_   = count;
+  }
+  const MultiTap* multiTapTable() const {
+    return entries_;
+  }
+  byte multiTapCount() const {
+    return count_;
+  }
+
+ private:
+  const MultiTap* entries_{nullptr};
+  byte            count_{0};
+};
+
+template <>
+class MultiTaps<false> {
+ public:
+  void setMultiTapTable(const MultiTap*, byte) {}
+  const MultiTap* multiTapTable() const { return nullptr; }
+  byte multiTapCount() const { return 0; }
+};
+
+// While a multi-tap qukey's taps are being counted, how many there have been so far
+// (otherwise zero), and its entry in the multi-tap table. Each of the plugin's sources
+// has one of these; with a `multi_tap_max` of 1, taps are never counted, and it's empty.
+template <bool _enabled>
+class TapCount {
+ public:
+  byte tapCount() const {
+    return tap_count_;
+  }
+  void setTapCount(byte tap_count) {
+    tap_count_ = tap_count;
+  }
+  byte tapEntry() const {
+    return tap_entry_;
+  }
+  void setTapEntry(byte tap_entry) {
+    tap_entry_ = tap_entry;
+  }
+
+ private:
+  byte tap_count_{0};
+  byte tap_entry_{0};
+};
+
+template <>
+class TapCount<false> {
+ public:
+  byte tapCount() const { return 0; }
+  void setTapCount(byte) {}
+  byte tapEntry() const { return 0; }
+  void setTapEntry(byte) {}
+};
+
+// With `batch_flush` or `capture_keys`, the addresses of the keys that were pressed with
+// values that aren't keyboard keys (e.g. layer shifts), so that the engine knows when
+// the release of one of them, which can change the keymap just as its press did, has
+// been flushed: a run of flushed events has to end there, and the captured values of
+// the keys still in the queue have to be looked up again. Its value can't be looked up
+// again when it's released, because the keymap might not be the same any more. It costs
+// one bit per key. With neither option, this is empty, so (because `Plugin` inherits
+// from it) it costs nothing.
+template <bool _enabled>
+class HeldKeymapKeys {
+ public:
+  // Record that `event` has gone on to the next handler, and return true if it could
+  // change the keymap.
+  bool recordSentEvent(const KeyEvent& event) {
+    byte addr = event.addr.addr();
+    byte mask = 1 << (addr % 8);
+    bool changes_keymap = held_bits_[addr / 8] & mask;
+    if (event.state.toggledOn()) {
+      changes_keymap = !isKeyboardKey(event.key);
+    }
+    if (changes_keymap && event.state.toggledOn()) {
+      held_bits_[addr / 8] |= mask;
+    } else {
+      held_bits_[addr / 8] &= ~mask;
+    }
+    return changes_keymap;
   }
 
  private:
-  Key primary_key_{cKey::clear};
-  Key alternate_key_{cKey::clear};
+  byte held_bits_[(total_keys + 7) / 8] = {};
+};
 
+template <>
+class HeldKeymapKeys<false> {
+ public:
+  bool recordSentEvent(const KeyEvent&) { return false; }
 };
 
 
-class Plugin : public EventHandler {
+typedef AdaptiveHoldTimeout<adaptive_hold_timeout, adaptive_hold_timeout_min, hold_timeout,
+                            adaptive_hold_percentile, adaptive_hold_margin> HoldTimeout;
+
+typedef IngestRing<ingest_ring_size, Timestamp> Ingest;
+
+typedef FlushBudget<flush_budget, Timestamp> Budget;
+
+class Plugin : public EventHandler, private Stats<collect_stats>, private HoldTimeout,
+               private Ingest, private Budget, private MultiTaps<(multi_tap_max > 1)>,
+               private HeldKeymapKeys<(batch_flush || capture_keys)> {
 
  public:
   template<byte _qukey_count>
-  Plugin(const Qukey (&qukeys)[_qukey_count], Keymap& keymap, Controller& controller)
-      : qukeys_(qukeys), qukey_count_(_qukey_count), keymap_(keymap), controller_(controller) {}
+  Plugin(const QukeyTable<_qukey_count>& qukeys, Keymap& keymap, Controller& controller)
+      : qukeys_(qukeys.entries), qukey_count_(_qukey_count), keymap_(keymap),
+        controller_(controller) {}
+  template<byte _qukey_count, byte _profile_count>
+  Plugin(const QukeyTable<_qukey_count>& qukeys,
+         const QukeyProfile (&profiles)[_profile_count],
+         Keymap& keymap, Controller& controller)
+      : qukeys_(qukeys.entries), qukey_count_(_qukey_count), profiles_(profiles),
+        profile_count_(_profile_count), keymap_(keymap), controller_(controller) {
+    static_assert(_profile_count <= Qukey::max_profile, "Too many qukey profiles");
+  }
 
   void activate(void) {
     plugin_active_ = true;
+    wake();
   }
   void deactivate(void) {
     plugin_active_ = false;
+    wake();
   }
   void toggle(void) {
     plugin_active_ = !plugin_active_;
+    wake();
   }
   void setMinimumOverlap(byte percentage) {
-    overlap_required_ = percentage;
-    if (overlap_required_ >= 100) {
-      overlap_required_ = 0;
-    }
+    release_delay_ = ReleaseDelay(percentage);
+    wake();
+  }
+  // Multi-tap keys (only used if `multi_tap_max` is more than 1)
+  template <byte _count>
+  void setMultiTaps(const MultiTapTable<_count>& multi_taps) {
+    setMultiTapTable(multi_taps.entries, _count);
+  }
+
+  // The earliest scan time (from the clock selected by `timestamp_ticks_per_ms`) at
+  // which the state of the queue could change without another keyswitch event
+  // arriving: the hold timeout of the qukey at the head of the queue, the timeout of
+  // its delayed release, or the end of a potential tap-hold sequence (with more than
+  // one source, the earliest of those for any source). Before then,
+  // `preKeyswitchScan()` returns immediately, so (as long as `hasDeadline()`) the
+  // firmware could sleep, or scan less often, until then. Without a deadline, the queue
+  // is empty, and there's nothing to do until the next keyswitch event.
+  bool hasDeadline() const;
+  Timestamp nextDeadline() const;
+  // Anything else that affects how queued events get resolved, like a layer change that
+  // doesn't come from a keyswitch event, should be followed by a call to `wake()`, so
+  // that the queue gets processed again (from scratch) in the next scan cycle.
+  void wake();
+
+  // Queue statistics (only collected if `collect_stats` is set)
+  const Stats<collect_stats>& stats() const {
+    return *this;
+  }
+  void resetStats() {
+    Stats<collect_stats>::reset();
+  }
+
+  // The adaptive hold timeout (only used if `adaptive_hold_timeout` is set)
+  const HoldTimeout& adaptiveHoldTimeout() const {
+    return *this;
+  }
+  void resetAdaptiveHoldTimeout() {
+    HoldTimeout::reset();
   }
 
   EventHandlerResult onKeyswitchEvent(KeyEvent& event);
 
+  // Report a keyswitch event from interrupt context (only if `ingest_ring_size` isn't
+  // zero). It only touches the ingest ring, so it never blocks, and doesn't need
+  // interrupts disabled anywhere; the event is queued at the start of the next scan
+  // cycle, with `time` (from the same clock as the queue's timestamps) as its timestamp.
+  // Returns false if the ring is full, in which case the event is dropped, and should be
+  // reported again later.
+  bool ingest(KeyAddr addr, bool press, Timestamp time) {
+    return Ingest::push({addr, press, time});
+  }
+
   void preKeyswitchScan();
 
  private:
-  // An array of Qukey objects
+  // The qukey table's entries (in PROGMEM), and how many there are
   const Qukey* const qukeys_;
   const byte         qukey_count_;
 
+  // What an out-of-range `QukeysKey` gets looked up as (see `qukeyAt()`)
+  static const Qukey empty_qukey;
+
+  // The qukey timing profiles (in PROGMEM). Profile 0 means the global settings, which
+  // are used for any qukey with a profile number that's out of range.
+  const QukeyProfile* const profiles_{nullptr};
+  const byte                profile_count_{0};
+
   // A reference to the keymap for lookups
   Keymap& keymap_;
 
@@ -114,23 +512,216 @@ class Plugin : public EventHandler {
   Controller& controller_;
 
   // The queue of keyswitch events
-  EventQueue<queue_max> event_queue_;
+  static_assert(queue_max <= 64, "queue_max can't be more than 64");
+  typedef EventQueue<queue_max, typename EventQueueBitfield<queue_max>::type,
+                     Timestamp, circular_event_queue, compact_timestamps, capture_keys>
+      Queue;
+  static_assert(!compact_timestamps ||
+                uint32_t(hold_timeout) * timestamp_ticks_per_ms <= 256,
+                "compact_timestamps requires a hold_timeout of at most 256 timestamp ticks");
+  static_assert(!compact_timestamps ||
+                uint32_t(tap_hold_timeout) * timestamp_ticks_per_ms <= 255,
+                "compact_timestamps requires a tap_hold_timeout of at most 255 timestamp "
+                "ticks");
 
   // Percentage overlap of subsequent key's press to cause qukey to take on
-  // alternate value
-  byte overlap_required_{99};
+  // alternate value, in the form of the release delay it translates to
+  ReleaseDelay release_delay_{99};
+
+  // Incremental resolution state for a qukey press in the queue: the queue index of
+  // the press, the qukey's index in the qukey table (as looked up when it started
+  // being tracked), the index of the next event to examine, the index of the first
+  // keypress after the qukey's press, the index of the qukey's release once it has
+  // been found (both zero if there isn't one yet), and how its state was determined
+  // (`Resolution::count` until it has been).
+  struct PendingQukey {
+    byte       press_index;
+    byte       qukey_index;
+    byte       scan_index;
+    byte       next_keypress_index;
+    byte       release_index;
+    Resolution resolution;
+  };
 
-  // If a tap-hold sequence hasn't been cancelled or timed out yet
-  bool release_delayed_for_tap_hold_{false};
+  static constexpr byte pending_max = concurrent_resolution ? queue_max : 1;
+
+  // The queue of events from one source (see `keySource()`), and the state of the
+  // resolution of the qukeys in it, which depends on nothing else. While a multi-tap
+  // qukey's taps are being counted, the release of the last tap is at the head of the
+  // queue, and none of the qukey's presses have been sent.
+  struct Source : TapCount<(multi_tap_max > 1)> {
+    Queue event_queue;
+
+    // See `nextDeadline()`
+    Timestamp next_deadline{0};
+
+    // The profile of the qukey at the head of the queue (or of the one whose release
+    // is waiting for a tap-hold sequence)
+    byte head_profile{0};
+
+    // If a tap-hold sequence hasn't been cancelled or timed out yet
+    bool release_delayed_for_tap_hold{false};
+
+    // The qukey presses being tracked, in queue order. Normally, that's only ever the
+    // one at the head of the queue; with `concurrent_resolution`, it's every one in the
+    // queue, and `tracked_count` is the number of events at the start of the queue that
+    // have already been checked for qukey presses.
+    PendingQukey pending[pending_max];
+    byte         pending_count{0};
+    byte         tracked_count{0};
+  };
+
+  // The sources, and the index of the one whose queue is being processed. With a
+  // single source, the index is never read.
+  static_assert(source_count >= 1 && source_count <= 8,
+                "source_count must be between 1 and 8");
+  Source sources_[source_count];
+  byte   source_{0};
 
   // Runtime controls
   bool plugin_active_{true};
 
+  // The time at the start of the current scan cycle, from the clock selected by
+  // `timestamp_ticks_per_ms`. Only that clock's function gets instantiated, so a
+  // controller needn't provide `scanStartTicks()` unless it's used.
+  template <bool _ticks> struct Clock {};
+  template <typename _Controller>
+  static Timestamp scanTime(Clock<false>) {
+    return _Controller::scanStartTime();
+  }
+  template <typename _Controller>
+  static Timestamp scanTime(Clock<true>) {
+    return _Controller::scanStartTicks();
+  }
+  static Timestamp scanTime() {
+    return scanTime<Controller>(Clock<(timestamp_ticks_per_ms > 1)>{});
+  }
+
+  EventHandlerResult queueEvent(KeyEvent& event, Timestamp time);
+  void drainIngestRing();
+  bool deadlineReached() const;
   void processQueue();
+  void processQueueInBatches();
+  byte oldestSource(byte skipped) const;
+  bool nextFlushEvent(KeyEvent& queued_event);
+  bool flushTimedOutQukey();
+  void wakeSources();
   bool updateFlushEvent(KeyEvent& queued_event);
-  bool releaseDelayed(uint16_t overlap_start, uint16_t overlap_end) const;
+  void shiftQueue();
+  void removeFromQueue(byte index);
+  void forgetEvent(byte index);
+  void recaptureKeys();
+  void resetResolution();
+  PendingQukey& headQukey(byte qukey_index);
+  bool resolve(PendingQukey& pending, KeyEvent& unrelated_release);
+  bool timedOut(PendingQukey& pending, byte profile, const ReleaseDelay& release_delay,
+                Timestamp time) const;
+  void resolvePendingQukeys();
+  void recordTapDuration(byte release_index);
+  bool releaseDelayed(Timestamp overlap_start, Timestamp overlap_end,
+                      const ReleaseDelay& release_delay) const;
+  void setDeadline(Timestamp deadline);
+  void setEarlierDeadline(Timestamp deadline);
   bool waitingForTapHold();
-  Qukey getQukey(Key key) const;
+  void startMultiTap(byte qukey_index);
+  Key multiTapKey() const;
+  bool multiTapDone() const;
+  const Qukey& getQukey(Key key) const;
+  const Qukey& qukeyAt(byte qukey_index) const;
+
+  // Each of these reads one value from a `Qukey` in PROGMEM. A SpaceCadet key's primary
+  // value is its hold value; any other qukey's is its tap value.
+  static byte readFlags(const Qukey& qukey) {
+    return readFromProgmem(qukey.flags_);
+  }
+  static Key tapKey(const Qukey& qukey) {
+    return readFromProgmem(qukey.tap_key_);
+  }
+  static Key holdKey(const Qukey& qukey) {
+    return readFromProgmem(qukey.hold_key_);
+  }
+  static Key primaryKey(const Qukey& qukey, bool spacecadet) {
+    return readFromProgmem(spacecadet ? qukey.hold_key_ : qukey.tap_key_);
+  }
+  static Key alternateKey(const Qukey& qukey, bool spacecadet) {
+    return readFromProgmem(spacecadet ? qukey.tap_key_ : qukey.hold_key_);
+  }
+
+  // The source whose queue is being processed, and that queue
+  Source& source() {
+    return sources_[(source_count > 1) ? source_ : 0];
+  }
+  const Source& source() const {
+    return sources_[(source_count > 1) ? source_ : 0];
+  }
+  Queue& queue() {
+    return source().event_queue;
+  }
+  const Queue& queue() const {
+    return source().event_queue;
+  }
+
+  // The value of the key pressed at queue position `index`: as it was when the press
+  // was queued, with `capture_keys`; otherwise, as it is now.
+  Key queuedKey(byte index) const {
+    if (capture_keys) {
+      return queue().key(index);
+    }
+    return keymap_[queue().addr(index)];
+  }
+
+  // Whether another event may be flushed in this scan cycle. Overflowing the queue
+  // isn't an option, so a full queue always may.
+  bool withinFlushBudget() const {
+    return (Budget::flushBudgetLeft() || queue().isFull());
+  }
+
+  // Hand a run of flushed events to the controller. Only the version selected by
+  // `batch_flush` gets instantiated, so `handleKeyEvents()` isn't required otherwise.
+  template <bool> struct BatchFlush {};
+  template <typename _Controller>
+  static void sendBatch(_Controller& controller, const KeyEvent* events, byte count,
+                        BatchFlush<true>) {
+    controller.handleKeyEvents(events, count);
+  }
+  template <typename _Controller>
+  static void sendBatch(_Controller& controller, const KeyEvent* events, byte count,
+                        BatchFlush<false>) {
+    for (byte i{0}; i < count; ++i) {
+      controller.handleKeyEvent(events[i]);
+    }
+  }
+
+  // A qukey's timing parameters, by profile. The global settings don't cost a PROGMEM
+  // read. Only the tap-hold timeout is never needed for any qukey but the head's. The
+  // timeouts are given in milliseconds, but returned in timestamp ticks.
+  byte qukeyProfile(byte flags) const {
+    byte profile = flags & Qukey::max_profile;
+    return (profile <= profile_count_) ? profile : 0;
+  }
+  void setHeadProfile(byte flags) {
+    source().head_profile = qukeyProfile(flags);
+  }
+  Timestamp holdTimeout(byte profile) const {
+    if (profile == 0) {
+      return Timestamp(HoldTimeout::timeout()) * timestamp_ticks_per_ms;
+    }
+    return Timestamp(readFromProgmem(profiles_[profile - 1].hold_timeout_)) *
+           timestamp_ticks_per_ms;
+  }
+  Timestamp tapHoldTimeout() const {
+    if (source().head_profile == 0) {
+      return Timestamp(tap_hold_timeout) * timestamp_ticks_per_ms;
+    }
+    return Timestamp(readFromProgmem(profiles_[source().head_profile - 1].tap_hold_timeout_)) *
+           timestamp_ticks_per_ms;
+  }
+  ReleaseDelay releaseDelay(byte profile) const {
+    if (profile == 0) {
+      return release_delay_;
+    }
+    return readFromProgmem(profiles_[profile - 1].release_delay_);
+  }
 };
 
 } // namespace qukeys {
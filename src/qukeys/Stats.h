@@ -0,0 +1,90 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace kaleidoglyph {
+namespace qukeys {
+
+// The reasons a qukey's state can be determined, from `preKeyswitchScan()` and
+// `updateFlushEvent()`.
+enum class Resolution : byte {
+  hold_timeout,        // the qukey was held for `hold_timeout` (alternate)
+  own_release,         // the qukey was released with no overlap (tap)
+  subsequent_press,    // a SpaceCadet qukey was followed by a keypress (primary)
+  subsequent_release,  // a key pressed after the qukey was released (alternate)
+  overlap_timeout,     // the qukey was released without enough overlap (primary)
+  full_queue,          // the queue filled up (primary)
+  inactive,            // Qukeys was turned off (primary)
+  same_zone_press,     // a key in the same zone was pressed (primary; bilateral only)
+  count,
+};
+
+// Queue statistics, for tuning `hold_timeout` and the minimum overlap from real typing.
+// The dwell time histogram counts events flushed from the queue by how long they waited
+// in it: bucket 0 is 0ms, bucket 1 is 1ms, and bucket `b` covers [2^(b-1), 2^b)
+// milliseconds, except for the last one, which also holds everything longer.
+template <bool _enabled>
+class Stats {
+ public:
+  static constexpr byte dwell_buckets{10};
+
+  void recordDwell(uint16_t dwell_time) {
+    byte bucket{0};
+    while (dwell_time != 0 && bucket < dwell_buckets - 1) {
+      dwell_time >>= 1;
+      ++bucket;
+    }
+    ++dwell_histogram_[bucket];
+  }
+  void recordResolution(Resolution resolution) {
+    ++resolutions_[byte(resolution)];
+  }
+  void recordBudgetHit() {
+    ++budget_hits_;
+  }
+
+  uint32_t dwellCount(byte bucket) const {
+    return dwell_histogram_[bucket];
+  }
+  uint32_t resolutionCount(Resolution resolution) const {
+    return resolutions_[byte(resolution)];
+  }
+  // The number of scan cycles in which `flush_budget` ran out before the queue did
+  uint32_t budgetHitCount() const {
+    return budget_hits_;
+  }
+
+  void reset() {
+    for (uint32_t& count : dwell_histogram_) count = 0;
+    for (uint32_t& count : resolutions_) count = 0;
+    budget_hits_ = 0;
+  }
+
+ private:
+  uint32_t dwell_histogram_[dwell_buckets] = {};
+  uint32_t resolutions_[byte(Resolution::count)] = {};
+  uint32_t budget_hits_{0};
+};
+
+// With statistics turned off, all of the above compiles away to nothing, and (because
+// `Plugin` inherits from it) this doesn't even take up a byte of RAM.
+template <>
+class Stats<false> {
+ public:
+  static constexpr byte dwell_buckets{0};
+
+  void recordDwell(uint16_t) {}
+  void recordResolution(Resolution) {}
+  void recordBudgetHit() {}
+
+  uint32_t dwellCount(byte) const { return 0; }
+  uint32_t resolutionCount(Resolution) const { return 0; }
+  uint32_t budgetHitCount() const { return 0; }
+
+  void reset() {}
+};
+
+} // namespace qukeys {
+} // namespace kaleidoglyph {
@@ -8,9 +8,28 @@ namespace qukeys {
 // Maximum size of the key queue; if one more key is pressed when the queue is full, the
 // first key in the queue (and any subsequent non-qukeys) will be flushed in its primary
 // state. 8 should be more than enough for any normal typing situation, and qukeys is best
-// turned off completely for gaming.
+// turned off completely for gaming. Up to 64 is supported; the queue's bitfields use the
+// smallest integer type that's wide enough.
 constexpr byte queue_max{8};
 
+// Storage layout of the key queue. The default linear layout moves every queued event
+// each time one is flushed, which is cheap for short queues; the circular layout makes
+// flushing an event O(1) at the cost of a little extra index arithmetic (and one byte
+// of RAM), and is the better choice for larger values of `queue_max`.
+constexpr bool circular_event_queue{false};
+
+// Storage of the key queue's timestamps. Normally, each queued event has a two-byte
+// timestamp; if this is set, only the first event's timestamp is stored in full, and each
+// of the others is stored as a one-byte offset from the event before it. That saves
+// `queue_max - 2` bytes of RAM (more, with `_Timestamp` types wider than 16 bits), which
+// makes larger queues practical on AVR, at the cost of a short loop each time the engine
+// reads the timestamp of an event other than the first. It requires `hold_timeout` to be
+// no more than 256ms, and `tap_hold_timeout` no more than 255ms (256 and 255 ticks, with
+// `timestamp_ticks_per_ms`), which keeps events in the queue from ever being further
+// apart than a one-byte offset can represent, so the timeouts behave exactly the same
+// either way. The timeouts of each `QukeyProfile` are clamped to fit.
+constexpr bool compact_timestamps{false};
+
 // If a qukey is in the queue at least this long (in milliseconds), it will be flushed
 // from the queue in its alternate state. This allows qukey modifiers to be used with
 // external pointing devices. This timeout value does not affect how long it takes for a
@@ -18,6 +37,19 @@ constexpr byte queue_max{8};
 // flushed before the timeout expires.
 constexpr uint16_t hold_timeout{200};
 
+// If this is set, the hold timeout adapts to the typist: Qukeys keeps an estimate of
+// the `adaptive_hold_percentile`th percentile of how long qukeys are held when they're
+// tapped, and uses that plus `adaptive_hold_margin` milliseconds as the hold timeout,
+// but never less than `adaptive_hold_timeout_min`, or more than `hold_timeout` (see
+// `qukeys/AdaptiveHoldTimeout.h`). That makes qukeys held as modifiers take effect
+// sooner for fast typists. Qukeys with their own timing profile aren't affected. It
+// costs four bytes of RAM, and the estimate can be read with
+// `Qukeys.adaptiveHoldTimeout()`.
+constexpr bool     adaptive_hold_timeout{false};
+constexpr byte     adaptive_hold_percentile{95};
+constexpr byte     adaptive_hold_margin{40};
+constexpr uint16_t adaptive_hold_timeout_min{120};
+
 // To enable the tap-hold feature, we need another timeout value. When a qukey
 // is tapped, it's release event will be delayed by this amount. If it is tapped
 // again before that timeout, the release event will again be delayed by the
@@ -27,5 +59,133 @@ constexpr uint16_t hold_timeout{200};
 // held since the initial press event.
 constexpr byte tap_hold_timeout{200};
 
+// The resolution of the timestamps that queued events get, in clock ticks per
+// millisecond. With the default of 1, they come from `Controller::scanStartTime()`, and
+// on a board that scans more than once per millisecond, events from consecutive scan
+// cycles can get the same timestamp, which makes the overlap between keys (and so the
+// release delay) coarse. With more, they come from `Controller::scanStartTicks()`, which
+// the controller then has to provide: e.g. 1000 for a microsecond clock, or the scan
+// rate in kHz for a count of scan cycles. The timeouts are still given in milliseconds,
+// but are measured (and the release delay is computed) in ticks. Timestamps are then 32
+// bits wide, which costs two more bytes of RAM per queue entry. With
+// `compact_timestamps`, the hold timeout has to fit in 256 ticks, and the tap-hold
+// timeout in 255 (e.g. with 8 ticks per millisecond, 32ms and 31ms).
+constexpr uint16_t timestamp_ticks_per_ms{1};
+
+// The most taps that a multi-tap qukey can tell apart (1 turns multi-tap qukeys off). A
+// multi-tap qukey (see `MultiTap` in `qukeys/Qukeys.h`) produces a different key for each
+// number of taps in a row, up to this many: each tap has to follow the release of the
+// previous one within the tap-hold timeout, and the count ends when it doesn't, when any
+// other key is pressed, or when there's no key for another tap. Holding the key down on
+// the last tap holds that count's key, as with tap-hold. The taps are counted, not kept
+// in the queue, which costs two bytes of RAM, and the tap key of a qukey that's tapped
+// once isn't sent until the count ends.
+constexpr byte multi_tap_max{1};
+
+// The size of the ring in which `Plugin::ingest()` collects keyswitch events reported from
+// interrupt context (e.g. by an interrupt-driven or DMA matrix scanner), until the next
+// scan cycle, when they're queued, each with the timestamp it was reported with. The
+// ring is lock-free (for a single producer and a single consumer), so neither side ever
+// blocks, or disables interrupts. It must be a power of two, no larger than 128. It
+// costs `sizeof(IngestRecord<Timestamp>)` bytes of RAM per entry, plus two: four bytes
+// per entry with the default 16-bit timestamps, but with a `timestamp_ticks_per_ms`
+// greater than 1, the timestamps are 32-bit, and each entry takes six bytes (eight on
+// boards that align 32-bit values, e.g. ARM). 0 turns it off.
+constexpr byte ingest_ring_size{0};
+
+// If this is set, keyswitch events that arrive while the queue is empty, and that aren't
+// presses of qukeys, skip the queue entirely, and proceed directly to the next event
+// handler. That saves every ordinary keystroke the trip through the queue, at the cost
+// of some PROGMEM (roughly 66 bytes).
+constexpr bool bypass_empty_queue{false};
+
+// If this is set, when a key is released while a qukey's state is still undetermined,
+// and that key's press has already been flushed from the queue, its release will be
+// flushed immediately (out of order), as long as it's not a modifier, a layer shift, or a
+// qukey. This keeps a tapped key from repeating because of rollover to a held qukey, and
+// keeps the queue from filling up (and prematurely flushing the qukey in its primary
+// state) during fast typing. It costs some PROGMEM (about 82 bytes), and weakens the
+// guarantee that keyswitch events are delivered in order.
+constexpr bool flush_unrelated_releases{false};
+
+// If this is set, each keypress is looked up in the keymap once, when it's added to the
+// queue, and its value is stored with it, instead of being looked up each time the
+// engine needs it (at least once more when it's flushed, and again on every pass for a
+// qukey). It doesn't change which layer a queued key's value comes from: when the press
+// or release of a key that isn't a keyboard key (e.g. a layer shift) is flushed ahead of
+// it, every queued keypress is looked up again. It costs two bytes of RAM per queue
+// entry, plus one bit per key.
+constexpr bool capture_keys{false};
+
+// If this is set, every qukey in the queue is resolved as soon as its own evidence
+// arrives, instead of only the one at the head of the queue. Each qukey's state is then
+// determined only by the events that follow its press and by its own timeouts, which are
+// measured against the timestamps of those events, so a qukey waiting behind another
+// undetermined one resolves exactly as it would have if it had been at the head of the
+// queue all along (e.g. during rollover, a qukey held past its hold timeout is a hold,
+// even if the qukey ahead of it is released later). Events are still flushed in order.
+// It costs six bytes of RAM per queue entry, and a keymap lookup for each queued press.
+constexpr bool concurrent_resolution{false};
+
+// If this is set, Qukeys uses "bilateral" resolution: when a key is pressed while a
+// (non-SpaceCadet) qukey's state is undetermined, and that key is in the same zone as the
+// qukey (as given by `keyZone()`), the qukey is resolved right away in its primary (tap)
+// state. Only presses of keys in another zone (usually on the other hand) can make it a
+// modifier. Rolling over keys on the same hand is most of what happens in fast typing,
+// so this lets most qukeys leave the queue without waiting for a release.
+constexpr bool bilateral_resolution{false};
+
+// The zone (hand) of the key at a given address, for `bilateral_resolution`. The default
+// suits a split keyboard with 16 keys per row, of which the first eight are on the left
+// hand, like the Keyboardio Model01.
+constexpr byte keyZone(byte addr) {
+  return ((addr % 16) < 8) ? 0 : 1;
+}
+
+// The number of independent sources of keyswitch events (e.g. the halves of a split
+// keyboard, or separate input devices), up to eight. Each source gets its own queue, and
+// its qukeys are resolved only by its own events, so a qukey waiting for its state to be
+// determined never holds up the keystrokes from another source. That also means a qukey
+// can't affect the keys from any other source, nor they it: a key from another source
+// that's pressed while a qukey is held is sent right away, without the qukey's hold
+// value, and the qukey only takes that value when it times out. When more than one
+// source's queue has events ready, they're flushed in the order they arrived, oldest
+// first. Each source costs the same RAM as the queue (and the resolution state) does for
+// one, plus about eight bytes.
+constexpr byte source_count{1};
+
+// The source of the key at a given address, for `source_count` (it must be less than
+// that). The default puts every key in source 0, so a sketch that sets `source_count` has
+// to replace it with the mapping for its hardware (e.g. `keyZone(addr)`, for a split
+// keyboard whose halves report their events separately).
+constexpr byte keySource(byte /* addr */) {
+  return 0;
+}
+
+// If this is set, the events that Qukeys flushes from the queue together (e.g. a qukey
+// and the keypresses that were waiting behind it) are passed on to the controller as a
+// group, with a single call to `Controller::handleKeyEvents()`, so that the reports they
+// produce can be coalesced. A group ends after any event that could change the keymap
+// (the press or release of anything but a keyboard key), because the value of the next
+// event in the queue can't be looked up until that one has been handled. It requires a
+// controller that provides `handleKeyEvents()`, and `queue_max` events' worth of stack,
+// and costs one bit of RAM per key, to remember which keys' releases end a group.
+constexpr bool batch_flush{false};
+
+// The maximum number of events Qukeys flushes from the queue in one scan cycle (0 means
+// no limit). When a qukey is resolved, it can release a whole queue's worth of events at
+// once, and each of them goes through the rest of the plugin chain; with a budget, the
+// rest are carried over to the following scan cycles, which keeps the time any one scan
+// cycle takes bounded. The budget is exceeded only when that's necessary to keep the
+// queue from overflowing. The count starts over in each call to `preKeyswitchScan()`
+// (or, if that isn't called in a scan cycle, when the scan time changes). With
+// `collect_stats`, the scan cycles in which the budget ran out are counted.
+constexpr byte flush_budget{0};
+
+// If this is set, Qukeys keeps statistics on how long events wait in the queue, and on
+// how each qukey's state was determined (see `qukeys/Stats.h`), which can be read with
+// `Qukeys.stats()`. This is meant for tuning the timeouts from real typing data.
+constexpr bool collect_stats{false};
+
 } // namespace qukeys {
 } // namespace kaleidoglyph {